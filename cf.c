@@ -3,17 +3,50 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD  1
+#endif
 
-/* Board dimenension */
+/* Board dimenension (default, see --board for the other sizes) */
 #define BOARD_WIDTH   7
 #define BOARD_HEIGHT  6
 
+/*
+ * Largest board
+ * - Any width x height with 4 <= width, height <= 9 and width * height <= 64
+ *   can be played, so that the board fits the 64 bit bitboard and the
+ *   column ('A' to 'I') and row ('1' to '9') headings stay single characters
+ */
+#define MAX_BOARD_WIDTH   9
+#define MAX_BOARD_HEIGHT  9
+
 /*
  * Maximum entries
- * - Maximum entries in the board
- * - Used for checking game over when there's no winner
+ * - Maximum entries in any board
+ * - Used to size move lists and as the unlimited search depth; the game over
+ *   check uses the size of the board being played
  */
-#define MAX_ENTRIES (BOARD_WIDTH * BOARD_HEIGHT)
+#define MAX_ENTRIES 64
 
 /*
  * Player type
@@ -28,6 +61,281 @@ typedef enum PlayerType {
                          PLAYER_MAX
 } PlayerType;
 
+/*
+ * Engine type
+ * - Used to select the algorithm behind getAINextMove()
+ * - ENGINE_FAST is the one ply greedy algorithm based on getScore()
+ * - ENGINE_SEARCH is the depth limited negamax search with alpha-beta pruning
+ * - ENGINE_MCTS is the Monte Carlo tree search with random playouts
+ */
+typedef enum EngineType {
+                         ENGINE_FAST,
+                         ENGINE_SEARCH,
+                         ENGINE_MCTS,
+                         ENGINE_MAX
+} EngineType;
+
+/* Default search depth in plies */
+#define DEFAULT_SEARCH_DEPTH  8
+
+/* Default number of empty cells at which the endgame solver takes over */
+#define DEFAULT_SOLVE_BELOW   16
+
+/* Default transposition table size in megabytes */
+#define DEFAULT_HASH_MB       16
+
+/* Default number of playouts per move of ENGINE_MCTS */
+#define DEFAULT_MCTS_PLAYOUTS 100000
+
+/*
+ * Win score
+ * - Score of a won position for the side to move
+ * - A win is scored WIN_SCORE minus the number of discs on the board when the
+ *   game is won, so faster wins score higher and slower losses score higher
+ * - Any score above WIN_THRESHOLD is a forced win (a board has at most 64 cells)
+ */
+#define WIN_SCORE     100000
+#define WIN_THRESHOLD (WIN_SCORE - 65)
+#define INFINITE_SCORE (WIN_SCORE + 1)
+
+/*
+ * Move ordering heuristics
+ * - Used to select how the search orders the columns of a node (EngineConfig::ordering)
+ * - ORDER_CENTER tries the columns center out instead of left to right
+ * - ORDER_KILLERS tries first the last two columns that caused a cutoff at the same ply
+ * - ORDER_HISTORY tries first the cells that caused the most (and deepest) cutoffs
+ * - ORDER_TT_MOVE tries first the best column stored in the transposition table
+ */
+#define ORDER_CENTER   0x1
+#define ORDER_KILLERS  0x2
+#define ORDER_HISTORY  0x4
+#define ORDER_TT_MOVE  0x8
+#define ORDER_ALL      (ORDER_CENTER | ORDER_KILLERS | ORDER_HISTORY | ORDER_TT_MOVE)
+
+/*
+ * Default move ordering
+ * - Killers and history make the tree larger when added to the center out
+ *   order in Connect 4 (see --order-bench), so they are off by default
+ */
+#define ORDER_DEFAULT  (ORDER_CENTER | ORDER_TT_MOVE)
+
+/* Names of the move ordering heuristics, in bit order */
+const char *orderNames[4] = { "center", "killers", "history", "tt" };
+
+/*
+ * Engine config structure
+ * - Used to configure the AI
+ * - type is the engine used by getAINextMove()
+ * - depth is the maximum search depth in plies of ENGINE_SEARCH
+ * - hashMB is the size of the transposition table in megabytes
+ * - moveTime is the time budget of one move in milliseconds (0 for no limit)
+ * - threads is the number of threads of ENGINE_SEARCH
+ * - bookFile is the opening book looked up before searching (NULL for none)
+ * - solveBelow is the number of empty cells at or below which the endgame is
+ *   solved exactly instead of searched (0 to never solve)
+ * - width and height are the size of the board played (the book must match)
+ * - ordering is the set of move ordering heuristics (ORDER_*) of ENGINE_SEARCH
+ * - ponder is 1 to search the replies of the opponent while it thinks
+ *   (interactive game and server only)
+ * - playouts is the number of playouts per move of ENGINE_MCTS (0 for no
+ *   limit, then moveTime must be set)
+ * - seed is the seed of the random numbers of the engine (ENGINE_MCTS
+ *   playouts and the last resort move of ENGINE_FAST)
+ */
+typedef struct EngineConfig {
+    EngineType  type;
+    int         depth;
+    int         hashMB;
+    int         moveTime;
+    int         threads;
+    const char *bookFile;
+    int         solveBelow;
+    int         width;
+    int         height;
+    int         ordering;
+    int         ponder;
+    long        playouts;
+    uint64_t    seed;
+} EngineConfig;
+
+/* Maximum number of search threads */
+#define MAX_SEARCH_THREADS  64
+
+/*
+ * Bound type
+ * - Used to tell how the score of a TableEntry relates to the real score
+ * - BOUND_EXACT is the real score
+ * - BOUND_LOWER is a lower bound (the search failed high)
+ * - BOUND_UPPER is an upper bound (the search failed low)
+ */
+typedef enum BoundType {
+                         BOUND_NONE,
+                         BOUND_EXACT,
+                         BOUND_LOWER,
+                         BOUND_UPPER,
+                         BOUND_MAX
+} BoundType;
+
+/*
+ * Table entry structure
+ * - Used to store the result of searching one position
+ * - data packs the score (bits 0-31), depth (bits 32-39), bound (bits 40-41),
+ *   best move column (bits 42-45) and table generation (bits 48-55)
+ * - Positions are stored under their canonical key (see positionKey()), and
+ *   the best move is a column of the canonical position
+ * - check is the key of the position XOR data. Threads share the
+ *   table without locks, and an entry torn by two concurrent writes no
+ *   longer matches its key, so it reads as a miss.
+ * - An empty entry has data 0 (a stored entry always has a depth)
+ */
+typedef struct TableEntry {
+    uint64_t check;
+    uint64_t data;
+} TableEntry;
+
+/* Number of entries per bucket, i.e. one 64 bytes cache line */
+#define TABLE_BUCKET_SIZE  4
+
+/*
+ * Table stats structure
+ * - Used to count the use of a transposition table
+ * - A hit is a probe that finds the position
+ * - A collision is a store that evicts a live entry of a different position
+ * - Each search thread counts in its own TableStats, which are added to the
+ *   table totals at the end of the search
+ */
+typedef struct TableStats {
+    long probes;
+    long hits;
+    long stores;
+    long collisions;
+} TableStats;
+
+/*
+ * Transposition table structure
+ * - Used to remember positions already searched through a different move order
+ * - entries is an array of numBuckets * TABLE_BUCKET_SIZE entries
+ * - numBuckets is a power of 2 and a key is stored in bucket (key & (numBuckets - 1))
+ * - generation is increased at each new search, so older entries get replaced first
+ * - stats is the total of the statistics of all the searches
+ */
+typedef struct TransTable {
+    TableEntry   *entries;
+    uint64_t      numBuckets;
+    unsigned int  generation;
+    TableStats    stats;
+} TransTable;
+
+/*
+ * Book file format
+ * - All the numbers are stored in the byte order of the machine
+ * - BookHeader, then count position keys (uint64_t, sorted ascending), then
+ *   count entries (uint32_t) in the same order as the keys
+ * - The keys are canonical (see positionKey()), so a position and its mirror
+ *   are stored once
+ * - An entry packs the best column of the canonical position (bits 0-3), the
+ *   search depth (bits 4-9) and the signed score (bits 10-31)
+ * - zobristCheck is a digest of zobristKeys, so a book built with different
+ *   keys is rejected instead of returning wrong moves
+ */
+#define BOOK_MAGIC    "CF4BOOK"
+#define BOOK_VERSION  2
+
+/* Default number of plies covered by the opening book */
+#define DEFAULT_BOOK_PLY  6
+
+typedef struct BookHeader {
+    char          magic[8];
+    uint32_t      version;
+    unsigned char width;
+    unsigned char height;
+    unsigned char ply;
+    unsigned char reserved;
+    uint64_t      zobristCheck;
+    uint64_t      count;
+} BookHeader;
+
+/*
+ * Book structure
+ * - Used to look up opening moves in a memory mapped book file
+ * - map and mapSize are the mapped file (map is NULL if no book is open)
+ * - keys and entries point into the mapped file
+ * - count is the number of positions in the book
+ */
+typedef struct Book {
+    void           *map;
+    size_t          mapSize;
+    const uint64_t *keys;
+    const uint32_t *entries;
+    uint64_t        count;
+} Book;
+
+/*
+ * Xoshiro structure
+ * - Used to hold the state of a xoshiro256** pseudo random number generator
+ * - Seeded with xoshiroSeed(), it's a few instructions per number and each
+ *   owner has its own, so random numbers need no lock and can be replayed
+ */
+typedef struct Xoshiro {
+    uint64_t s[4];
+} Xoshiro;
+
+/*
+ * Engine structure
+ * - Used to hold the AI and the state it keeps from one move to the next
+ * - config is the configuration of the AI
+ * - table is the transposition table of ENGINE_SEARCH
+ * - book is the opening book of ENGINE_SEARCH
+ * - rng is the random number generator of the engine, seeded again from
+ *   config.seed and the position at every search (see searchSeed())
+ * - trees are the search trees of ENGINE_MCTS, one per thread (numTrees)
+ */
+typedef struct Engine {
+    EngineConfig     config;
+    TransTable       table;
+    Book             book;
+    Xoshiro          rng;
+    struct MctsTree *trees;
+    int              numTrees;
+} Engine;
+
+/*
+ * Search result structure
+ * - Used to return the outcome of a search
+ * - column is the best column index (-1 if there's no legal move)
+ * - score is the score of column for the side to move
+ * - depth is the depth of the last completed iteration
+ * - nodes is the number of positions visited
+ * - timeUs is the time spent in microseconds
+ * - bookHit is 1 if the column comes from the opening book
+ * - solved is 1 if score is the exact result of the game (see solvePosition())
+ * - ponderHit is 1 if the column was searched while pondering (see finishPonder())
+ * - fast is 1 if the column comes from ENGINE_FAST (see fastNextMove())
+ * - cutoffs is the number of beta cutoffs, firstCutoffs the ones made by the
+ *   first move tried, threatCutoffs the positions cut by zugzwangBound()
+ * - tableStats counts the use of the transposition table by this search
+ * - playouts is the number of random playouts of ENGINE_MCTS (0 for the others)
+ * - pv is the principal variation as a string of columns, read back from the
+ *   transposition table (see readPrincipalVariation())
+ */
+typedef struct SearchResult {
+    int       column;
+    int       score;
+    int       depth;
+    long      nodes;
+    long long timeUs;
+    int       bookHit;
+    int       solved;
+    int       ponderHit;
+    int       fast;
+    long      cutoffs;
+    long      firstCutoffs;
+    long      threatCutoffs;
+    long      playouts;
+    TableStats tableStats;
+    char      pv[MAX_ENTRIES + 1];
+} SearchResult;
+
 /*
  * Grid structure
  * - Used to represents each entry on the board
@@ -53,24 +361,132 @@ typedef struct Grid {
     struct Grid *downRight;
 } Grid;
 
+/*
+ * Maximum moves
+ * - Capacity of the move history of a game
+ */
+#define MAX_MOVES  MAX_ENTRIES
+
 /*
  * Move structure
  * - Used to store historical data
- * - data can be 'A' to 'G'. i.e. the column label
- * - next is one Move of the linear linked list
+ * - data can be 'A' to 'I'. i.e. the column label
+ * - disc is the disc that was dropped ('X' or 'O')
+ * - row is the landing row index (0 is the bottom row)
  */
 typedef struct Move {
-    char         data;
-    struct Move *next;
+    char data;
+    char disc;
+    char row;
 } Move;
 
+/*
+ * Position structure
+ * - Compact bitboard representation of the game board
+ * - discs[0] holds the cells taken by 'X' and discs[1] the cells taken by 'O'
+ * - Bit (column * stride + row) is the cell at columnIndex and row, where
+ *   row 0 is the bottom row
+ * - stride is height + 1 when the board fits, so that the extra bit on top of
+ *   every column is always empty and shifting a run never carries it into the
+ *   next column; boards with no room for it (9x7) use a stride of height and
+ *   mask the runs instead (see bitboardHasFourPacked())
+ * - heights is the number of discs in each column
+ * - numFilled is the total number of discs on the board
+ * - geometry is the index of the board size in geometries[]
+ * - key is the Zobrist key of the position, updated on every drop and undo
+ * - mirrorKey is the Zobrist key of its left-right mirror, updated alongside;
+ *   the smaller of the two is the canonical key (see positionKey())
+ * - The whole position fits in a single cache line and is copied by value
+ */
+typedef struct Position {
+    uint64_t      discs[2];
+    uint64_t      key;
+    uint64_t      mirrorKey;
+    unsigned char heights[MAX_BOARD_WIDTH];
+    unsigned char width;
+    unsigned char height;
+    unsigned char stride;
+    unsigned char numFilled;
+    unsigned char geometry;
+} Position;
+
+/* Maximum number of four-in-a-row lines of a board (130 on 8x8) */
+#define MAX_LINES       136
+
+/* Maximum number of lines through one cell (4 per direction) */
+#define MAX_CELL_LINES  16
+
+/* Maximum number of board geometries in use at once */
+#define MAX_GEOMETRIES  16
+
+/*
+ * Line table structure
+ * - Used to list every four-in-a-row line of a board geometry
+ * - masks[i] is the bitboard mask of the 4 cells of line i
+ * - cellLines[cell] are the indexes of the lines through bitboard cell, and
+ *   numCellLines[cell] is their count
+ * - A table is built once per geometry by getGeometry() and never changes
+ */
+typedef struct LineTable {
+    int           numLines;
+    uint64_t      masks[MAX_LINES];
+    unsigned char numCellLines[64];
+    unsigned char cellLines[64][MAX_CELL_LINES];
+} LineTable;
+
+/*
+ * Geometry identifiers
+ * - Board sizes with win checks specialized at compile time (constant shifts
+ *   and masks), always at these indexes of geometries[]
+ * - Other sizes go through the generic checks and get the next indexes
+ */
+typedef enum GeometryId {
+                         GEOMETRY_7X6,
+                         GEOMETRY_8X7,
+                         GEOMETRY_9X7,
+                         GEOMETRY_GENERIC
+} GeometryId;
+
+/*
+ * Geometry structure
+ * - Used to hold what depends on the board size only
+ * - stride is the distance between two horizontal neighbors in the bitboard
+ * - lowRows are the cells of rows 0 to height - 4 and highRows the cells of
+ *   rows 3 to height - 1, i.e. where a vertical/rising and a falling run of 4
+ *   can start; only used when stride is height
+ * - cells are all the cells of the board, oddRows the cells of rows 0, 2...
+ *   and evenRows those of rows 1, 3... (odd and even counting the bottom row
+ *   as 1, as in the threat analysis)
+ * - lines is the line table of the board
+ */
+typedef struct Geometry {
+    int       width;
+    int       height;
+    int       stride;
+    uint64_t  lowRows;
+    uint64_t  highRows;
+    uint64_t  cells;
+    uint64_t  oddRows;
+    uint64_t  evenRows;
+    LineTable lines;
+} Geometry;
+
+/*
+ * Line counts structure
+ * - Used to keep the number of discs of each player on every line of a LineTable
+ * - counts[player][line] is updated on every move and take back
+ */
+typedef struct LineCounts {
+    unsigned char counts[2][MAX_LINES];
+} LineCounts;
+
 /*
  * Board structure
  * - Used to represent the game board
  * - width is the width of the board
  * - height is the height of the board
- * - columnHeadings is the column headings ('A' through 'G' from left to right)
- * - rowHeadings is the row headings ('6' to '1' from top to bottom)
+ * - columnHeadings is the column headings ('A' through 'G' from left to right on 7x6)
+ * - rowHeadings is the row headings ('6' to '1' from top to bottom on 7x6)
  * - grids represents the 2-dimensional grids that made up the game board
  */
 typedef struct Board {
@@ -81,25 +497,82 @@ typedef struct Board {
     Grid **grids;
 } Board;
 
+/*
+ * Ponder structure
+ * - Used to search the replies of the opponent on a background thread while
+ *   it thinks, so the answer to its move is ready when it comes
+ * - engine is the engine searching (not owned); it's not used by anybody else
+ *   while the thread runs
+ * - pos is the position the opponent moves from, and columns its replies in
+ *   the order they are searched, the best one of the table first
+ * - results holds the answer to each reply, valid if searched has the bit
+ *   of the column
+ * - current is the reply being searched (-1 for none) and target the reply
+ *   played once known (-1 until then); cancel abandons the current search
+ * - lock protects current, target, searched and results
+ */
+typedef struct Ponder {
+    pthread_t       thread;
+    Engine         *engine;
+    Position        pos;
+    int             columns[MAX_BOARD_WIDTH];
+    int             numColumns;
+    SearchResult    results[MAX_BOARD_WIDTH];
+    unsigned int    searched;
+    int             current;
+    int             target;
+    int             cancel;
+    int             running;
+    pthread_mutex_t lock;
+} Ponder;
+
 /*
  * Game structure
  * - Used to represents the connect 4 game
  * - board is the game board
- * - history is a linear linked list of Move structure
+ * - position is the bitboard copy of the board used for win and score checks
+ * - history is the stack of moves played so far, numMoves is its size
  * - firstPlayer is type of the first player (either PLAYER_AI or PLAYER_HUMAN)
  * - numFilled is the count of number of 'X' or 'O' on the board
  * - AIDisc - 'X' if computer goes first. 'O' if computer goes second.
  * - humanDisc - 'X' if human goes first. 'O' if human goes second.
+ * - engine is the AI used by the computer (not owned, ENGINE_FAST if NULL)
+ * - ponder searches the replies of the human while it thinks (not owned,
+ *   NULL for none)
+ * - lines is the line table of the board and lineCounts the discs of each
+ *   player on these lines, used for constant time win and score checks
+ * - lastSearch is the record (depth reached, time spent...) of the last AI search
  */
 typedef struct Game {
     Board      *board;
-    Move       *history;
+    Position    position;
+    Move        history[MAX_MOVES];
+    int         numMoves;
     PlayerType  firstPlayer;
     int         numFilled;
     char        AIDisc;
     char        humanDisc;
+    Engine     *engine;
+    Ponder     *ponder;
+    const LineTable *lines;
+    LineCounts  lineCounts;
+    SearchResult lastSearch;
 } Game;
 
+/* Maximum number of idle games kept by a GamePool */
+#define GAME_POOL_SIZE  8
+
+/*
+ * Game pool structure
+ * - Used to reuse games instead of allocating one per game played
+ * - games are the idle games, numGames is their count
+ * - A pool isn't thread safe; every thread uses its own
+ */
+typedef struct GamePool {
+    Game *games[GAME_POOL_SIZE];
+    int   numGames;
+} GamePool;
+
 /*
  * Get grid
  * - Used to return pointer of a grid at location (x, y)
@@ -206,667 +679,7313 @@ void setupGrid(Board *board, int x, int y) {
 }
 
 /*
- * Create board
- * - Used to create the game board
- * - Allocate memories for the grids, column and row headings
- * - Initializes each grid by calling setupGrid()
- * - Initializes the column headings from 'A' to 'G' (left to right)
- * - Initializes the row headings from '6 to '1 (top to bottom)
+ * Board arena size
+ * - Used to return the number of bytes holding a board of width x height
+ * - The Board structure, the row pointers, the grids and the headings are
+ *   laid out one after the other in a single block
  */
-Board *createBoard(int width, int height) {
-    Board *board = NULL;
+size_t boardArenaSize(int width, int height) {
+    return sizeof(Board) + height * sizeof(Grid *) + width * height * sizeof(Grid) + width + height;
+}
+
+/*
+ * Clear board
+ * - Used to empty every grid of the board (data is set to '.')
+ */
+void clearBoard(Board *board) {
     int i, j;
-    board = (Board *) calloc(1, sizeof(Board));
-    if (board != NULL) {
-        board->width = width;
-        board->height = height;
-        board->grids = (Grid **) calloc(1, board->height * sizeof(Grid *));
-        for (i=0; i < board->height; i++) {
-            (*(board->grids + i)) = (Grid *) calloc(board->width, sizeof(Grid));
-        }
 
-        /* Initialize data */
-        for (i=0; i < board->width; i++) {
-            for (j=0; j < board->height; j++) {
-                ((*(board->grids+j))+i)->data = '.';
-                setupGrid(board, i, j);
-            };
-        }
-        /* initialize column headings */
-        board->columnHeadings = (char *) calloc(1, board->width);
-        for (i=0; i < board->width; i++) {
-            *(board->columnHeadings) = (char)(((int) 'A') + i);
-        }
-        /* initialize row headings */
-        board->rowHeadings = (char *) calloc(1, board->height);
-        for (i=0; i < board->height; i++) {
-            *(board->rowHeadings+i) = (char)(((int) '6') - i);
+    for (i=0; i < board->width; i++) {
+        for (j=0; j < board->height; j++) {
+            getGrid(board, i, j)->data = '.';
         }
     }
+}
+
+/*
+ * Init board
+ * - Used to carve a board out of arena (boardArenaSize() zeroed bytes)
+ * - Initializes each grid by calling setupGrid()
+ * - Initializes the column headings from 'A' (left to right)
+ * - Initializes the row headings from the height down to '1' (top to bottom)
+ */
+Board *initBoard(void *arena, int width, int height) {
+    Board *board = (Board *) arena;
+    Grid *grids;
+    int i, j;
+
+    board->width = width;
+    board->height = height;
+    board->grids = (Grid **) (board + 1);
+    grids = (Grid *) (board->grids + height);
+    for (i=0; i < board->height; i++) {
+        (*(board->grids + i)) = grids + i * width;
+    }
+    board->columnHeadings = (char *) (grids + width * height);
+    board->rowHeadings = board->columnHeadings + width;
+
+    /* Initialize data */
+    for (i=0; i < board->width; i++) {
+        for (j=0; j < board->height; j++) {
+            ((*(board->grids+j))+i)->data = '.';
+            setupGrid(board, i, j);
+        };
+    }
+    /* initialize column headings */
+    for (i=0; i < board->width; i++) {
+        *(board->columnHeadings + i) = (char)(((int) 'A') + i);
+    }
+    /* initialize row headings */
+    for (i=0; i < board->height; i++) {
+        *(board->rowHeadings+i) = (char)(((int) '0') + height - i);
+    }
 
     return board;
 }
 
+/*
+ * Create board
+ * - Used to create the game board
+ * - The board is allocated as a single block and set up by initBoard()
+ */
+Board *createBoard(int width, int height) {
+    void *arena = calloc(1, boardArenaSize(width, height));
+
+    if (arena == NULL) {
+        return NULL;
+    }
+    return initBoard(arena, width, height);
+}
+
 /*
  * Delete board
- * - Delete the game board and free all the allocated memories
+ * - Delete a board made by createBoard()
  */
 void deleteBoard(Board *board) {
-    int i, j;
-    if (board) {
-        if (board->columnHeadings) {
-            free(board->columnHeadings);
-        }
-        if (board->rowHeadings) {
-            free(board->rowHeadings);
-        }
-        if (board->grids) {
-            for (i=0; i < board->height; i++) {
-                free(*(board->grids + i));
-            }
-            free(board->grids);
-        }
-        free(board);
+    free(board);
+}
+
+/*
+ * Disc index
+ * - Used to map the disc data to the index of Position::discs
+ * - 'X' is index 0 and 'O' is index 1
+ */
+int discIndex(char data) {
+    return (data == 'X') ? 0 : 1;
+}
+
+/*
+ * Zobrist keys
+ * - One random key per disc and bitboard cell
+ * - The key of a position is the XOR of the keys of all its discs
+ * - The keys come from a fixed seed, so they are the same in every run
+ */
+uint64_t zobristKeys[2][64];
+int zobristReady = 0;
+
+/*
+ * SplitMix64
+ * - Used to generate a sequence of 64-bit pseudo random numbers from state
+ */
+uint64_t splitMix64(uint64_t *state) {
+    uint64_t z;
+
+    *state += 0x9E3779B97F4A7C15ULL;
+    z = *state;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/*
+ * Xoshiro seed
+ * - Used to seed rng from seed, expanded to the 256 bits of state with splitMix64()
+ */
+void xoshiroSeed(Xoshiro *rng, uint64_t seed) {
+    int i;
+
+    for (i=0; i < 4; i++) {
+        rng->s[i] = splitMix64(&seed);
     }
 }
 
 /*
- * Create game
- * - Create a game structure by allocating memory from the heap
- * - Call createBoard() to create a game board
- * - Setup the history, firstPlayer, numFilledd, AIDisc and humanDisc parameters
+ * Xoshiro next
+ * - Used to return the next 64-bit pseudo random number of rng (xoshiro256**)
  */
-Game *createGame(PlayerType first, int width, int height) {
-    Game *game = NULL;
-    Board *board = NULL;
+static inline uint64_t xoshiroNext(Xoshiro *rng) {
+    uint64_t *s = rng->s;
+    uint64_t result = ((s[1] * 5) << 7 | (s[1] * 5) >> 57) * 9;
+    uint64_t t = s[1] << 17;
 
-    game = (Game *) calloc(1, sizeof(Game));
-    if (game != NULL) {
-        board = createBoard(width, height);
-        if (board != NULL) {
-            game->board = board;
-            game->history = NULL;
-            game->firstPlayer = first;
-            game->numFilled = 0;
-            game->AIDisc = (game->firstPlayer == PLAYER_AI) ? 'X' : 'O';
-            game->humanDisc = (game->firstPlayer == PLAYER_HUMAN) ? 'X' : 'O';
-        }
-        else {
-            free(game);
-            game = NULL;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = (s[3] << 45) | (s[3] >> 19);
+
+    return result;
+}
+
+/*
+ * Xoshiro below
+ * - Used to return a pseudo random number from 0 to n - 1
+ * - The high 32 bits are scaled by n instead of taking a remainder, which is
+ *   faster and unbiased enough for the small n used here
+ */
+static inline int xoshiroBelow(Xoshiro *rng, int n) {
+    return (int) (((xoshiroNext(rng) >> 32) * (uint64_t) n) >> 32);
+}
+
+/*
+ * Search seed
+ * - Used to return the seed of the random numbers of one search: seed mixed
+ *   with the Zobrist key of the position searched
+ * - The engines seed their generators with it at the start of every search,
+ *   so a move depends only on the seed and the position, not on the searches
+ *   made before (or on which worker makes it)
+ */
+uint64_t searchSeed(uint64_t seed, uint64_t key) {
+    uint64_t state = seed ^ key;
+
+    return splitMix64(&state);
+}
+
+/*
+ * Init zobrist
+ * - Used to fill zobristKeys once
+ */
+void initZobrist(void) {
+    uint64_t state = 0x43344634C0FFEEULL;
+    int i;
+
+    if (!zobristReady) {
+        for (i=0; i < 64; i++) {
+            zobristKeys[0][i] = splitMix64(&state);
+            zobristKeys[1][i] = splitMix64(&state);
         }
+        zobristReady = 1;
     }
-    return game;
 }
 
+/* Geometries in use so far, see getGeometry() */
+Geometry geometries[MAX_GEOMETRIES];
+int numGeometries = 0;
+pthread_mutex_t geometriesLock = PTHREAD_MUTEX_INITIALIZER;
+
 /*
- * Delete game
- * - Delete the game structure and free all the allocated memories
+ * Build line table
+ * - Used to fill table with the lines of a width x height board whose
+ *   bitboard columns are stride bits apart
+ * - Lines are listed horizontal, vertical, then both diagonals
  */
-void deleteGame(Game *game) {
-    Move *move = NULL;
-    Move *next = NULL;
-    if (game != NULL) {
-        if (game->board) {
-            deleteBoard(game->board);
-        }
+void buildLineTable(LineTable *table, int width, int height, int stride) {
+    static const int directions[4][2] = { {1, 0}, {0, 1}, {1, 1}, {1, -1} };
+    int d, x, y, i, line, index;
+    int endX, endY;
 
-        if (game->history != NULL) {
-            move = game->history;
-            while (move != NULL) {
-                next = move->next;
-                free(move);
-                move = next;
+    memset(table, 0, sizeof(LineTable));
+    for (d=0; d < 4; d++) {
+        for (x=0; x < width; x++) {
+            for (y=0; y < height; y++) {
+                endX = x + 3 * directions[d][0];
+                endY = y + 3 * directions[d][1];
+                if (endX >= width || endY < 0 || endY >= height || table->numLines >= MAX_LINES) {
+                    continue;
+                }
+                line = table->numLines++;
+                for (i=0; i < 4; i++) {
+                    index = (x + i * directions[d][0]) * stride + y + i * directions[d][1];
+                    table->masks[line] |= ((uint64_t) 1) << index;
+                    table->cellLines[index][table->numCellLines[index]++] = (unsigned char) line;
+                }
             }
         }
-        free(game);
     }
-
 }
 
 /*
- * isWinHorizontal
- * - Check if the game is won along the horizontal direction
- * - board is the game board
- * - (x, y) is the location of the newly added grid
- * - data is either 'X or 'O'
- * - neighbors left and right of the current gridof the same type are counted
- * - Total count is returned as score
- * - If total counter is greater than or equal to 4, this is the winner
+ * Build geometry
+ * - Used to fill geometry for a width x height board
  */
-int isWinHorizontal(Board *board, int x, int y, char data, int *score) {
-    int winning = 0;
-    Grid *grid = NULL;
-    int total = 1;
-
-    if (board) {
-        /* Check left */
-        grid = getGrid(board, x, y);
-        while (grid->left != NULL && grid->left->data == data) {
-            total++;
-            grid = grid->left;
-        }
-        /* Check right */
-        grid = getGrid(board, x, y);
-        while (grid->right != NULL && grid->right->data == data) {
-            total++;
-            grid = grid->right;
-        }
+void buildGeometry(Geometry *geometry, int width, int height) {
+    int x, y;
 
-        if (total >= 4) {
-            winning = 1;
+    geometry->width = width;
+    geometry->height = height;
+    geometry->stride = (width * (height + 1) <= 64) ? height + 1 : height;
+    geometry->lowRows = 0;
+    geometry->highRows = 0;
+    geometry->cells = 0;
+    geometry->oddRows = 0;
+    geometry->evenRows = 0;
+    for (x=0; x < width; x++) {
+        for (y=0; y < height; y++) {
+            geometry->cells |= ((uint64_t) 1) << (x * geometry->stride + y);
+            if ((y & 1) == 0) {
+                geometry->oddRows |= ((uint64_t) 1) << (x * geometry->stride + y);
+            }
+            else {
+                geometry->evenRows |= ((uint64_t) 1) << (x * geometry->stride + y);
+            }
+            if (y <= height - 4) {
+                geometry->lowRows |= ((uint64_t) 1) << (x * geometry->stride + y);
+            }
+            if (y >= 3) {
+                geometry->highRows |= ((uint64_t) 1) << (x * geometry->stride + y);
+            }
         }
-        *score = total;
     }
+    buildLineTable(&geometry->lines, width, height, geometry->stride);
+}
 
-    return winning;
+/*
+ * Is valid geometry
+ * - Used to return if a width x height board can be played (see MAX_BOARD_WIDTH)
+ */
+int isValidGeometry(int width, int height) {
+    return (width >= 4 && width <= MAX_BOARD_WIDTH && height >= 4 && height <= MAX_BOARD_HEIGHT &&
+            width * height <= 64);
 }
 
 /*
- * isWinVertical
- * - Check if the game is won along the vertical direction
- * - board is the game board
- * - (x, y) is the location of the newly added grid
- * - data is either 'X or 'O'
- * - neighbors above and below the current gridof the same type are counted
- * - Total count is returned as score
- * - If total counter is greater than or equal to 4, this is the winner
+ * Get geometry
+ * - Used to return the index in geometries[] of a width x height board
+ * - The specialized sizes are set up first, so they get the GeometryId indexes
+ * - Geometries are built on first use and shared by all the threads; the count
+ *   is published after the geometry is written, so readers don't need the lock
+ * - Returns -1 if the size isn't valid or MAX_GEOMETRIES are already in use
  */
-int isWinVertical(Board *board, int x, int y, char data, int *score) {
-    int winning = 0;
-    Grid *grid = NULL;
-    int total = 1;
+int getGeometry(int width, int height) {
+    int count = __atomic_load_n(&numGeometries, __ATOMIC_ACQUIRE);
+    int index = -1;
+    int i;
 
-    if (board) {
-        /* Check up */
-        grid = getGrid(board, x, y);
-        while (grid->up != NULL && grid->up->data == data) {
-            total++;
-            grid = grid->up;
-        }
-        /* Check down */
-        grid = getGrid(board, x, y);
-        while (grid->down != NULL && grid->down->data == data) {
-            total++;
-            grid = grid->down;
+    for (i=0; i < count; i++) {
+        if (geometries[i].width == width && geometries[i].height == height) {
+            return i;
         }
+    }
+    if (!isValidGeometry(width, height)) {
+        return -1;
+    }
 
-        if (total >= 4) {
-            winning = 1;
+    pthread_mutex_lock(&geometriesLock);
+    if (numGeometries == 0) {
+        buildGeometry(&geometries[GEOMETRY_7X6], 7, 6);
+        buildGeometry(&geometries[GEOMETRY_8X7], 8, 7);
+        buildGeometry(&geometries[GEOMETRY_9X7], 9, 7);
+        __atomic_store_n(&numGeometries, GEOMETRY_GENERIC, __ATOMIC_RELEASE);
+    }
+    for (i=0; i < numGeometries && index < 0; i++) {
+        if (geometries[i].width == width && geometries[i].height == height) {
+            index = i;
         }
-        *score = total;
     }
+    if (index < 0 && numGeometries < MAX_GEOMETRIES) {
+        index = numGeometries;
+        buildGeometry(&geometries[index], width, height);
+        __atomic_store_n(&numGeometries, numGeometries + 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&geometriesLock);
 
-    return winning;
+    return index;
 }
 
 /*
- * isWinLeftDiagonal
- * - Check if the game is won along the left diagonal direction
- * - board is the game board
- * - (x, y) is the location of the newly added grid
- * - data is either 'X or 'O'
- * - neighbors along upper left and lower right of the current gridof the same type are counted
- * - Total count is returned as score
-* - If total counter is greater than or equal to 4, this is the winner
+ * Get line table
+ * - Used to return the line table of a width x height board
+ * - Returns NULL if the size can't be played
  */
-int isWinLeftDiagonal(Board *board, int x, int y, char data, int *score) {
-    int winning = 0;
+const LineTable *getLineTable(int width, int height) {
+    int index = getGeometry(width, height);
+
+    return (index < 0) ? NULL : &geometries[index].lines;
+}
+
+/*
+ * Init position
+ * - Used to setup an empty bitboard position of width x height
+ * - The caller guarantees that isValidGeometry(width, height)
+ */
+void initPosition(Position *pos, int width, int height) {
+    int i;
+
+    initZobrist();
+    pos->discs[0] = 0;
+    pos->discs[1] = 0;
+    pos->key = 0;
+    pos->mirrorKey = 0;
+    for (i=0; i < MAX_BOARD_WIDTH; i++) {
+        pos->heights[i] = 0;
+    }
+    pos->geometry = (unsigned char) getGeometry(width, height);
+    pos->width = (unsigned char) width;
+    pos->height = (unsigned char) height;
+    pos->stride = (unsigned char) geometries[pos->geometry].stride;
+    pos->numFilled = 0;
+}
+
+/*
+ * Position lines
+ * - Used to return the line table of the board of pos
+ */
+const LineTable *positionLines(const Position *pos) {
+    return &geometries[pos->geometry].lines;
+}
+
+/*
+ * Position cell
+ * - Used to return the bit of the cell at columnIndex and row (0 is the bottom row)
+ */
+uint64_t positionCell(const Position *pos, int columnIndex, int row) {
+    return ((uint64_t) 1) << (columnIndex * pos->stride + row);
+}
+
+/*
+ * Position can play
+ * - Used to return if there's room for one more disc on columnIndex
+ */
+int positionCanPlay(const Position *pos, int columnIndex) {
+    return (columnIndex >= 0 && columnIndex < pos->width &&
+            pos->heights[columnIndex] < pos->height);
+}
+
+/*
+ * Bitboard runs of four
+ * - Used to return the cells that start a run of 4 bits along shift
+ * - pairs = bits & (bits >> shift) marks every cell that starts a run of 2,
+ *   then pairs & (pairs >> 2 * shift) marks every cell that starts a run of 4
+ */
+static inline uint64_t bitboardRunsOfFour(uint64_t bits, int shift) {
+    uint64_t pairs = bits & (bits >> shift);
+
+    return pairs & (pairs >> (2 * shift));
+}
+
+/*
+ * Bitboard has four
+ * - Used to return if bits contains four cells in a row along any direction
+ * - shift is height + 1, i.e. the distance between two horizontal neighbors,
+ *   and the spare bit on top of each column stops the runs at the edges
+ */
+static inline int bitboardHasFour(uint64_t bits, int shift) {
+    return ((bitboardRunsOfFour(bits, 1) |              /* Vertical */
+             bitboardRunsOfFour(bits, shift) |          /* Horizontal */
+             bitboardRunsOfFour(bits, shift - 1) |      /* Left diagonal */
+             bitboardRunsOfFour(bits, shift + 1)) != 0); /* Right diagonal */
+}
+
+/*
+ * Bitboard has four packed
+ * - Same as bitboardHasFour() for a board with no spare bit (shift is height)
+ * - Runs going up or down would wrap into the next column, so they only count
+ *   from the cells of lowRows (vertical, right diagonal) or highRows (left
+ *   diagonal); horizontal runs can't wrap
+ */
+static inline int bitboardHasFourPacked(uint64_t bits, int shift, uint64_t lowRows, uint64_t highRows) {
+    return (((bitboardRunsOfFour(bits, 1) & lowRows) |
+             bitboardRunsOfFour(bits, shift) |
+             (bitboardRunsOfFour(bits, shift - 1) & highRows) |
+             (bitboardRunsOfFour(bits, shift + 1) & lowRows)) != 0);
+}
+
+/*
+ * Specialized has four
+ * - bitboardHasFour() for the GeometryId sizes, with every shift and mask a
+ *   constant so that the checks are fully unrolled
+ * - The 9x7 masks are the rows 0-3 and 3-6 of each 7 bit column
+ */
+int hasFour7x6(uint64_t bits) {
+    return bitboardHasFour(bits, 7);
+}
+
+int hasFour8x7(uint64_t bits) {
+    return bitboardHasFour(bits, 8);
+}
+
+int hasFour9x7(uint64_t bits) {
+    return bitboardHasFourPacked(bits, 7, 0x0F1E3C78F1E3C78FULL, 0x78F1E3C78F1E3C78ULL);
+}
+
+/*
+ * Position has four
+ * - Used to return if bits, a set of cells of pos, contains four in a row
+ * - The specialized sizes take the fast path, the others the generic checks
+ */
+int positionHasFour(const Position *pos, uint64_t bits) {
+    const Geometry *geometry;
+
+    switch (pos->geometry) {
+    case GEOMETRY_7X6:
+        return hasFour7x6(bits);
+    case GEOMETRY_8X7:
+        return hasFour8x7(bits);
+    case GEOMETRY_9X7:
+        return hasFour9x7(bits);
+    default:
+        geometry = &geometries[pos->geometry];
+        if (geometry->stride == geometry->height + 1) {
+            return bitboardHasFour(bits, geometry->stride);
+        }
+        return bitboardHasFourPacked(bits, geometry->stride, geometry->lowRows, geometry->highRows);
+    }
+}
+
+/*
+ * Position drop disc
+ * - Bitboard version of dropDisc()
+ * - Used to add a disc of player on top of columnIndex
+ * - Returns the row (0 is the bottom row) of the new disc or -1 if the column is full
+ */
+int positionDropDisc(Position *pos, int columnIndex, int player) {
+    int row = -1;
+
+    if (positionCanPlay(pos, columnIndex)) {
+        row = pos->heights[columnIndex];
+        pos->discs[player] |= positionCell(pos, columnIndex, row);
+        pos->key ^= zobristKeys[player][columnIndex * pos->stride + row];
+        pos->mirrorKey ^= zobristKeys[player][(pos->width - 1 - columnIndex) * pos->stride + row];
+        pos->heights[columnIndex]++;
+        pos->numFilled++;
+    }
+
+    return row;
+}
+
+/*
+ * Position undo disc
+ * - Used to remove the top disc of columnIndex
+ */
+void positionUndoDisc(Position *pos, int columnIndex) {
+    uint64_t cell;
+    int index;
+    int player;
+
+    if (pos->heights[columnIndex] > 0) {
+        pos->heights[columnIndex]--;
+        pos->numFilled--;
+        index = columnIndex * pos->stride + pos->heights[columnIndex];
+        cell = ((uint64_t) 1) << index;
+        player = (pos->discs[0] & cell) ? 0 : 1;
+        pos->discs[player] &= ~cell;
+        pos->key ^= zobristKeys[player][index];
+        pos->mirrorKey ^= zobristKeys[player][(pos->width - 1 - columnIndex) * pos->stride +
+                                              pos->heights[columnIndex]];
+    }
+}
+
+/*
+ * Position key
+ * - Used to return the canonical key of pos: the smaller of its key and the
+ *   key of its mirror, so that a position and its mirror share their entries
+ *   in the transposition table, the book and the position index
+ */
+uint64_t positionKey(const Position *pos) {
+    return (pos->mirrorKey < pos->key) ? pos->mirrorKey : pos->key;
+}
+
+/*
+ * Canonical column
+ * - Used to translate column between pos and its canonical form: mirrored if
+ *   the canonical key is the key of the mirror, unchanged otherwise
+ * - Mirroring twice is the identity, so the same call translates a column
+ *   to the canonical form and back; -1 (no column) is left as is
+ */
+int canonicalColumn(const Position *pos, int column) {
+    return (column >= 0 && pos->mirrorKey < pos->key) ? pos->width - 1 - column : column;
+}
+
+/*
+ * Update line counts
+ * - Used to add delta (1 on a move, -1 on a take back) to the count of player
+ *   on every line through bitboard cell index
+ */
+void updateLineCounts(const LineTable *lines, LineCounts *lineCounts, int index, int player, int delta) {
+    int i;
+
+    for (i=0; i < lines->numCellLines[index]; i++) {
+        lineCounts->counts[player][lines->cellLines[index][i]] += delta;
+    }
+}
+
+/*
+ * Line counts score
+ * - Used to return the most discs of player on one line through bitboard
+ *   cell index, among the lines not blocked by the other player
+ * - Returns 0 if every line through the cell is blocked
+ */
+int lineCountsScore(const LineTable *lines, const LineCounts *lineCounts, int index, int player) {
+    const unsigned char *cellLines = lines->cellLines[index];
+    int highestScore = 0;
+    int i;
+
+    for (i=0; i < lines->numCellLines[index]; i++) {
+        if (lineCounts->counts[player ^ 1][cellLines[i]] == 0 &&
+            lineCounts->counts[player][cellLines[i]] > highestScore) {
+            highestScore = lineCounts->counts[player][cellLines[i]];
+        }
+    }
+
+    return highestScore;
+}
+
+/*
+ * Position line score
+ * - Same as lineCountsScore() with the counts taken from the bitboards of pos
+ * - Used when there are no LineCounts at hand (the engines work on a Position)
+ */
+int positionLineScore(const Position *pos, const LineTable *lines, int index, int player) {
+    const unsigned char *cellLines = lines->cellLines[index];
+    uint64_t mask;
+    int highestScore = 0;
+    int total;
+    int i;
+
+    for (i=0; i < lines->numCellLines[index]; i++) {
+        mask = lines->masks[cellLines[i]];
+        if ((pos->discs[player ^ 1] & mask) == 0) {
+            total = __builtin_popcountll(pos->discs[player] & mask);
+            if (total > highestScore) {
+                highestScore = total;
+            }
+        }
+    }
+
+    return highestScore;
+}
+
+/*
+ * Position get score
+ * - Bitboard version of getScore()
+ * - Used to return the score of the next free cell on columnIndex for player
+ * - The board is not modified
+ */
+int positionGetScore(const Position *pos, const LineTable *lines, int columnIndex, int player, int *score) {
+    int success = 0;
+
+    if (lines != NULL && positionCanPlay(pos, columnIndex)) {
+        success = 1;
+        *score = 1 + positionLineScore(pos, lines, columnIndex * pos->stride + pos->heights[columnIndex],
+                                       player);
+    }
+
+    return success;
+}
+
+/*
+ * Position is winning move
+ * - Used to return if player wins by dropping a disc on columnIndex
+ * - Only the mask of player is checked, with shift-and-AND
+ */
+int positionIsWinningMove(const Position *pos, int columnIndex, int player) {
+    uint64_t cell;
+
+    if (!positionCanPlay(pos, columnIndex)) {
+        return 0;
+    }
+    cell = positionCell(pos, columnIndex, pos->heights[columnIndex]);
+    return positionHasFour(pos, pos->discs[player] | cell);
+}
+
+/*
+ * Position is game over
+ * - Used to return if all the cells of the position are filled
+ */
+int positionIsGameOver(const Position *pos) {
+    return (pos->numFilled == pos->width * pos->height);
+}
+
+/*
+ * Position threats
+ * - Used to return the threats of bits (the discs of a player): the empty
+ *   cells of pos that would complete a four, playable yet or not
+ * - Boards with a spare bit on top of each column find them with shifts, as
+ *   bitboardHasFour() does: a cell is a threat if it ends a run of 3 or sits
+ *   in a gap of one along a direction. The others go through the line table.
+ */
+uint64_t positionThreats(const Position *pos, uint64_t bits) {
+    const Geometry *geometry = &geometries[pos->geometry];
+    uint64_t empty = geometry->cells & ~(pos->discs[0] | pos->discs[1]);
+    uint64_t threats, pairs;
+    int shifts[3];
+    int i;
+
+    if (geometry->stride == geometry->height) {
+        threats = 0;
+        for (i=0; i < geometry->lines.numLines; i++) {
+            if (__builtin_popcountll(geometry->lines.masks[i] & bits) == 3) {
+                threats |= geometry->lines.masks[i];
+            }
+        }
+        return threats & empty;
+    }
+
+    shifts[0] = geometry->stride;        /* Horizontal */
+    shifts[1] = geometry->stride - 1;    /* Left diagonal */
+    shifts[2] = geometry->stride + 1;    /* Right diagonal */
+    threats = (bits << 1) & (bits << 2) & (bits << 3);    /* Vertical */
+    for (i=0; i < 3; i++) {
+        pairs = (bits << shifts[i]) & (bits << (2 * shifts[i]));
+        threats |= pairs & (bits << (3 * shifts[i]));
+        threats |= pairs & (bits >> shifts[i]);
+        pairs = (bits >> shifts[i]) & (bits >> (2 * shifts[i]));
+        threats |= pairs & (bits << shifts[i]);
+        threats |= pairs & (bits >> (3 * shifts[i]));
+    }
+
+    return threats & empty;
+}
+
+/*
+ * Zugzwang bound
+ * - Used to return an upper bound of the score of the player to move at pos
+ *   found by the odd/even threat analysis, or INFINITE_SCORE if none applies
+ * - When every column has an even number of empty cells, the other player
+ *   can answer each move in the same column (follow-up) until the board is
+ *   full. The player to move then gets the empty cells of one row parity
+ *   only (the odd rows on a board of even height) and the other player those
+ *   of the other parity, so every threat of the wrong parity is dead.
+ * - If the discs of the player to move and its empty cells hold no four, it
+ *   can't win and the bound is a tie. If the discs and the empty cells of the
+ *   other player hold one too, the other player wins, at the latest with the
+ *   last cell.
+ */
+int zugzwangBound(const Position *pos) {
+    const Geometry *geometry = &geometries[pos->geometry];
+    int player = pos->numFilled & 1;
+    uint64_t empty, own;
+    int i;
+
+    for (i=0; i < pos->width; i++) {
+        if (((pos->height - pos->heights[i]) & 1) != 0) {
+            return INFINITE_SCORE;
+        }
+    }
+    empty = geometry->cells & ~(pos->discs[0] | pos->discs[1]);
+    own = ((pos->height & 1) == 0) ? geometry->oddRows : geometry->evenRows;
+    if (positionHasFour(pos, pos->discs[player] | (empty & own))) {
+        return INFINITE_SCORE;
+    }
+    if (positionHasFour(pos, pos->discs[player ^ 1] | (empty & ~own))) {
+        return -(WIN_SCORE - pos->width * pos->height);
+    }
+
+    return 0;
+}
+
+/*
+ * Reset game
+ * - Used to start a new game in place, keeping the board and the engine
+ * - Setup the history, firstPlayer, numFilled, AIDisc and humanDisc parameters
+ */
+void resetGame(Game *game, PlayerType first) {
+    clearBoard(game->board);
+    initPosition(&game->position, game->board->width, game->board->height);
+    game->numMoves = 0;
+    game->firstPlayer = first;
+    game->numFilled = 0;
+    game->AIDisc = (game->firstPlayer == PLAYER_AI) ? 'X' : 'O';
+    game->humanDisc = (game->firstPlayer == PLAYER_HUMAN) ? 'X' : 'O';
+    memset(&game->lineCounts, 0, sizeof(LineCounts));
+    memset(&game->lastSearch, 0, sizeof(SearchResult));
+}
+
+/*
+ * Create game
+ * - Create a game structure by allocating memory from the heap
+ * - The game and its board (see initBoard()) share a single block, so a game
+ *   is one allocation and the move path allocates nothing
+ * - Call resetGame() to setup the parameters
+ */
+Game *createGame(PlayerType first, int width, int height) {
+    Game *game = NULL;
+
+    if (getGeometry(width, height) < 0) {
+        return NULL;
+    }
+    game = (Game *) calloc(1, sizeof(Game) + boardArenaSize(width, height));
+    if (game != NULL) {
+        game->board = initBoard(game + 1, width, height);
+        game->engine = NULL;
+        game->ponder = NULL;
+        game->lines = getLineTable(width, height);
+        resetGame(game, first);
+    }
+    return game;
+}
+
+/*
+ * Delete game
+ * - Delete the game structure and free all the allocated memories
+ */
+void deleteGame(Game *game) {
+    free(game);
+}
+
+/*
+ * Acquire game
+ * - Used to take a game of width x height from the pool and reset it
+ * - A new game is created when the pool has none of that size
+ */
+Game *acquireGame(GamePool *pool, PlayerType first, int width, int height) {
+    Game *game;
+    int i;
+
+    for (i=pool->numGames - 1; i >= 0; i--) {
+        game = pool->games[i];
+        if (game->board->width == width && game->board->height == height) {
+            pool->games[i] = pool->games[--pool->numGames];
+            game->engine = NULL;
+            game->ponder = NULL;
+            resetGame(game, first);
+            return game;
+        }
+    }
+    return createGame(first, width, height);
+}
+
+/*
+ * Release game
+ * - Used to give a game back to the pool for reuse
+ * - The game is deleted when the pool is full
+ */
+void releaseGame(GamePool *pool, Game *game) {
+    if (game == NULL) {
+        return;
+    }
+    if (pool->numGames < GAME_POOL_SIZE) {
+        pool->games[pool->numGames++] = game;
+    }
+    else {
+        deleteGame(game);
+    }
+}
+
+/*
+ * Clear game pool
+ * - Used to delete all the games kept by the pool
+ */
+void clearGamePool(GamePool *pool) {
+    while (pool->numGames > 0) {
+        deleteGame(pool->games[--pool->numGames]);
+    }
+}
+
+/*
+ * isWinHorizontal
+ * - Check if the game is won along the horizontal direction
+ * - board is the game board
+ * - (x, y) is the location of the newly added grid
+ * - data is either 'X or 'O'
+ * - neighbors left and right of the current gridof the same type are counted
+ * - Total count is returned as score
+ * - If total counter is greater than or equal to 4, this is the winner
+ */
+int isWinHorizontal(Board *board, int x, int y, char data, int *score) {
+    int winning = 0;
     Grid *grid = NULL;
     int total = 1;
 
-    if (board) {
-        /* Check upLeft */
-        grid = getGrid(board, x, y);
-        while (grid->upLeft != NULL && grid->upLeft->data == data) {
-            total++;
-            grid = grid->upLeft;
+    if (board) {
+        /* Check left */
+        grid = getGrid(board, x, y);
+        while (grid->left != NULL && grid->left->data == data) {
+            total++;
+            grid = grid->left;
+        }
+        /* Check right */
+        grid = getGrid(board, x, y);
+        while (grid->right != NULL && grid->right->data == data) {
+            total++;
+            grid = grid->right;
+        }
+
+        if (total >= 4) {
+            winning = 1;
+        }
+        *score = total;
+    }
+
+    return winning;
+}
+
+/*
+ * isWinVertical
+ * - Check if the game is won along the vertical direction
+ * - board is the game board
+ * - (x, y) is the location of the newly added grid
+ * - data is either 'X or 'O'
+ * - neighbors above and below the current gridof the same type are counted
+ * - Total count is returned as score
+ * - If total counter is greater than or equal to 4, this is the winner
+ */
+int isWinVertical(Board *board, int x, int y, char data, int *score) {
+    int winning = 0;
+    Grid *grid = NULL;
+    int total = 1;
+
+    if (board) {
+        /* Check up */
+        grid = getGrid(board, x, y);
+        while (grid->up != NULL && grid->up->data == data) {
+            total++;
+            grid = grid->up;
+        }
+        /* Check down */
+        grid = getGrid(board, x, y);
+        while (grid->down != NULL && grid->down->data == data) {
+            total++;
+            grid = grid->down;
+        }
+
+        if (total >= 4) {
+            winning = 1;
+        }
+        *score = total;
+    }
+
+    return winning;
+}
+
+/*
+ * isWinLeftDiagonal
+ * - Check if the game is won along the left diagonal direction
+ * - board is the game board
+ * - (x, y) is the location of the newly added grid
+ * - data is either 'X or 'O'
+ * - neighbors along upper left and lower right of the current gridof the same type are counted
+ * - Total count is returned as score
+* - If total counter is greater than or equal to 4, this is the winner
+ */
+int isWinLeftDiagonal(Board *board, int x, int y, char data, int *score) {
+    int winning = 0;
+    Grid *grid = NULL;
+    int total = 1;
+
+    if (board) {
+        /* Check upLeft */
+        grid = getGrid(board, x, y);
+        while (grid->upLeft != NULL && grid->upLeft->data == data) {
+            total++;
+            grid = grid->upLeft;
+        }
+        /* Check downRight */
+        grid = getGrid(board, x, y);
+        while (grid->downRight != NULL && grid->downRight->data == data) {
+            total++;
+            grid = grid->downRight;
+        }
+
+        if (total >= 4) {
+            winning = 1;
+        }
+        *score = total;
+    }
+
+    return winning;
+}
+
+/*
+ * isWinRightDiagonal
+ * - Check if the game is won along the right diagonal direction
+ * - board is the game board
+ * - (x, y) is the location of the newly added grid
+ * - data is either 'X or 'O'
+ * - neighbors along upper right and lower left of the current gridof the same type are counted
+ * - Total count is returned as score
+ * - If total counter is greater than or equal to 4, this is the winner
+ */
+int isWinRightDiagonal(Board *board, int x, int y, char data, int *score) {
+    int winning = 0;
+    Grid *grid = NULL;
+    int total = 1;
+
+    if (board) {
+        /* Check upRight */
+        grid = getGrid(board, x, y);
+        while (grid->upRight != NULL && grid->upRight->data == data) {
+            total++;
+            grid = grid->upRight;
+        }
+        /* Check downLeft */
+        grid = getGrid(board, x, y);
+        while (grid->downLeft != NULL && grid->downLeft->data == data) {
+            total++;
+            grid = grid->downLeft;
+        }
+
+        if (total >= 4) {
+            winning = 1;
+        }
+        *score = total;
+   }
+
+    return winning;
+}
+
+/*
+ * isWin
+ * - Check if a winner after a new data is added to location (x, y)
+ * - 4 paths are checked: horizonal, vertical, left diagonal and right diagonal
+ * - data is either 'X' or 'O'
+ * - score is highest total count among all 4 paths
+ */
+int isWin(Board *board, int x, int y, char data, int *score) {
+    int winning = 0;
+    int horizontalScore = 0;
+    int verticalScore = 0;
+    int leftDiagonalScore = 0;
+    int rightDiagonalScore = 0;
+    int highestScore = 0;
+
+    if (isWinHorizontal(board, x, y, data, &horizontalScore)) {
+        winning = 1;
+    }
+    else if (isWinVertical(board, x, y, data, &verticalScore)) {
+        winning = 1;
+    }
+    else if (isWinLeftDiagonal(board, x, y, data, &leftDiagonalScore)) {
+        winning = 1;
+    }
+    else if (isWinRightDiagonal(board, x, y, data, &rightDiagonalScore)) {
+        winning = 1;
+    }
+
+    highestScore = horizontalScore;
+    if (verticalScore > highestScore) {
+        highestScore = verticalScore;
+    }
+    if (leftDiagonalScore > highestScore) {
+        highestScore = leftDiagonalScore;
+    }
+    if (rightDiagonalScore > highestScore) {
+        highestScore = rightDiagonalScore;
+    }
+
+    *score = highestScore;
+    return winning;
+}
+
+/*
+ *isGameOver
+ * - Used to return if game is over without a winner (tie game)
+ * - Tie game is determined when all grids are filled but no coonect 4.
+ */
+int isGameOver(Game *game) {
+    int gameOver = 0;
+
+    if (game != NULL) {
+        gameOver = positionIsGameOver(&game->position);
+    }
+
+    return gameOver;
+}
+
+/*
+ * Make move
+ * - Used to drop disc data into columnIndex and push it on the move history
+ * - The bitboard position, the line counts and the grid are updated together
+ * - Nothing is allocated, so it's cheap enough to be used inside a search
+ * - Returns the landing row index (0 is the bottom row), -1 if the column is
+ *   full or out of range
+ */
+int makeMove(Game *game, int columnIndex, char data) {
+    Board *board = game->board;
+    Move *move;
+    int row;
+
+    if (columnIndex < 0 || columnIndex >= board->width || game->numMoves >= MAX_MOVES ||
+        !positionCanPlay(&game->position, columnIndex)) {
+        return -1;
+    }
+    row = positionDropDisc(&game->position, columnIndex, discIndex(data));
+    updateLineCounts(game->lines, &game->lineCounts, columnIndex * game->position.stride + row,
+                     discIndex(data), 1);
+    getGrid(board, columnIndex, board->height - 1 - row)->data = data;
+    move = &game->history[game->numMoves++];
+    move->data = (char) ('A' + columnIndex);
+    move->disc = data;
+    move->row = (char) row;
+
+    return row;
+}
+
+/*
+ * Unmake move
+ * - Used to take back the last move of the history
+ * - The bitboard position, the line counts and the grid are restored together
+ * - Returns 0 if there's no move to take back
+ */
+int unmakeMove(Game *game) {
+    Board *board = game->board;
+    Move *move;
+    int columnIndex;
+
+    if (game->numMoves == 0) {
+        return 0;
+    }
+    move = &game->history[--game->numMoves];
+    columnIndex = move->data - 'A';
+    positionUndoDisc(&game->position, columnIndex);
+    updateLineCounts(game->lines, &game->lineCounts, columnIndex * game->position.stride + move->row,
+                     discIndex(move->disc), -1);
+    getGrid(board, columnIndex, board->height - 1 - move->row)->data = '.';
+
+    return 1;
+}
+
+/*
+ * dropDisc
+ * - Used to drop a disc into column ('A' to 'G')
+ * - The move is made with makeMove()
+ * - The win and the score are looked up in the line counts: the score is the
+ *   most discs of data on one open line through the new disc, 4 is a win
+ */
+int dropDisc(Game *game, char column, char data, char *row, int *won, int *score) {
+    int success = 0;
+    int columnIndex = (int) (column - 'A');
+    int i=0;
+
+    if (game->board) {
+        i = makeMove(game, columnIndex, data);
+        if (i >= 0) {
+            success = 1;
+            *row = (char) ((int) '0') + (i + 1);
+            *score = lineCountsScore(game->lines, &game->lineCounts,
+                                     columnIndex * game->position.stride + i, discIndex(data));
+            if (*score < 1) {
+                *score = 1;
+            }
+            *won = (*score >= 4);
+        }
+    }
+
+    return success;
+}
+
+/*
+ * getScore
+ * - Used to return the score of a grid
+ * - The grid's column index is represented by columnIndex
+ * - The row index is the first '.' from bottom
+ * - The score is 1 plus the most discs of data on one line through the grid
+ *   not blocked by the other player, looked up in the line counts
+ * - The board is untouched
+ */
+int getScore(Game *game, int columnIndex, char data, int *score) {
+    Position *pos = &game->position;
+    int success = 0;
+
+    if (positionCanPlay(pos, columnIndex)) {
+        success = 1;
+        *score = 1 + lineCountsScore(game->lines, &game->lineCounts,
+                                     columnIndex * pos->stride + pos->heights[columnIndex],
+                                     discIndex(data));
+    }
+
+    return success;
+}
+
+/*
+ * Play moves
+ * - Used to replay a list of columns ('A' to 'G') with dropDisc()
+ * - 'X' and 'O' alternate, starting with 'X' on an empty board
+ * - Characters other than 'A' to 'Z' are skipped
+ * - Returns 0 if a move can't be played
+ */
+int playMoves(Game *game, const char *moves) {
+    char row;
+    int won, score;
+    char data;
+
+    for (; *moves != '\0'; moves++) {
+        if (*moves >= 'A' && *moves <= 'Z') {
+            data = ((game->position.numFilled & 1) == 0) ? 'X' : 'O';
+            if (!dropDisc(game, *moves, data, &row, &won, &score)) {
+                return 0;
+            }
+            game->numFilled++;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * print board
+ * - Used to print the game board
+ */
+void printBoard(Board *board) {
+    int i, j;
+    Grid *grid;
+    if (board) {
+        printf("  ");
+        for (i=0; i < board->width; i++) {
+            printf("%c ", *(board->columnHeadings + i));
+        }
+        printf("\n");
+
+        for (i=0; i < board->height; i++) {
+            printf("%c ", *(board->rowHeadings+i));
+            for (j=0; j < board->width; j++) {
+                grid = getGrid(board, j, i);
+                printf("%c ", grid->data);
+            }
+            printf("\n");
+        }
+    }
+}
+
+/*
+ * Center column
+ * - Used to return the i-th column in center out order
+ * - e.g. 3, 2, 4, 1, 5, 0, 6 for 7 columns
+ */
+int centerColumn(int width, int i) {
+    return (width / 2) + (((i & 1) == 0) ? (i / 2) : -((i + 1) / 2));
+}
+
+/*
+ * Fast next move
+ * - Find the next move (i.e. column index) of the side to move with ENGINE_FAST
+ * - The algorithm is:
+ *   1. Find the score of the next grid on each column if the human is taken over
+ *   2. If the highest score is greater than 2, the computer will use this as next move
+ *   3. The idea is to prevent the human from getting a better score in the next move
+ *   4. If the human's highest score is less than or equals to 2, the algorithm will
+ *      search for the highest score for the computer
+ *   5. This is done to improve the winning situation of the computer
+ *   6. Finally, a random playable column is picked with rng if all fail, or
+ *      the playable column closest to the center if rng is NULL
+ * - The computer is the side to move of pos and the human is the other side
+ * - Columns are scanned center out, so ties go to the column closest to the center
+ */
+int fastNextMove(const Position *pos, Xoshiro *rng) {
+    int nextMove;
+    int AIPlayer = pos->numFilled & 1;
+    int score = 0;
+    int i = 0;
+    int column;
+    int success = 0;
+    int highestScore = 0;
+    int highestColumn = -1;
+    int columns[MAX_BOARD_WIDTH];
+    int numColumns = 0;
+    const LineTable *lines = positionLines(pos);
+
+    for (i=0; i < pos->width; i++) {
+        column = centerColumn(pos->width, i);
+        success = positionGetScore(pos, lines, column, AIPlayer ^ 1, &score);
+        if (success) {
+            if (score > highestScore) {
+                highestScore = score;
+                highestColumn = column;
+            }
+        }
+    }
+
+    if (highestScore > 2) {
+        nextMove = highestColumn;
+    }
+    else {
+        for (i=0; i < pos->width; i++) {
+            column = centerColumn(pos->width, i);
+            success = positionGetScore(pos, lines, column, AIPlayer, &score);
+            if (success) {
+                if (score > highestScore) {
+                    highestScore = score;
+                    highestColumn = column;
+                }
+            }
+        }
+
+        if (highestColumn != -1) {
+            nextMove = highestColumn;
+        }
+        else {
+            /* Random chosen next move */
+            for (i=0; i < pos->width; i++) {
+                column = centerColumn(pos->width, i);
+                if (positionCanPlay(pos, column)) {
+                    columns[numColumns++] = column;
+                }
+            }
+            nextMove = -1;
+            if (numColumns > 0) {
+                nextMove = columns[(rng != NULL) ? xoshiroBelow(rng, numColumns) : 0];
+            }
+        }
+
+    }
+
+    return nextMove;
+}
+
+/*
+ * Position play moves
+ * - Used to play a sequence of columns ('A' to 'G') from the current position
+ * - The players alternate, starting with the side to move
+ * - Spaces, commas and brackets are skipped, so the "[A,B,...]" list printed
+ *   by gameStat() can be used as is
+ * - Returns 0 if a column is unknown or full, or if a move follows a win
+ */
+int positionPlayMoves(Position *pos, const char *moves) {
+    int player, columnIndex;
+    const char *move;
+
+    for (move=moves; *move != '\0'; move++) {
+        if (*move == ' ' || *move == ',' || *move == '[' || *move == ']' ||
+            *move == '\n' || *move == '\r' || *move == '\t') {
+            continue;
+        }
+        columnIndex = (int) (*move - 'A');
+        player = pos->numFilled & 1;
+        if (!positionCanPlay(pos, columnIndex)) {
+            return 0;
+        }
+        if (positionHasFour(pos, pos->discs[player ^ 1])) {
+            return 0;
+        }
+        positionDropDisc(pos, columnIndex, player);
+    }
+
+    return 1;
+}
+
+/*
+ * Create table
+ * - Used to allocate a transposition table of at most hashMB megabytes
+ * - The number of buckets is rounded down to a power of 2
+ * - Returns 0 if the memory cannot be allocated
+ */
+int createTable(TransTable *table, int hashMB) {
+    uint64_t bytes = ((uint64_t) hashMB) * 1024 * 1024;
+    uint64_t bucketBytes = TABLE_BUCKET_SIZE * sizeof(TableEntry);
+    uint64_t numBuckets = 1;
+
+    memset(table, 0, sizeof(TransTable));
+    while (numBuckets * 2 * bucketBytes <= bytes) {
+        numBuckets *= 2;
+    }
+    table->entries = (TableEntry *) calloc(numBuckets * TABLE_BUCKET_SIZE, sizeof(TableEntry));
+    if (table->entries == NULL) {
+        return 0;
+    }
+    table->numBuckets = numBuckets;
+
+    return 1;
+}
+
+/*
+ * Delete table
+ * - Free the entries of the transposition table
+ */
+void deleteTable(TransTable *table) {
+    if (table->entries) {
+        free(table->entries);
+        table->entries = NULL;
+    }
+    table->numBuckets = 0;
+}
+
+/*
+ * Table entry accessors
+ * - Used to unpack the fields of TableEntry::data
+ */
+int tableEntryScore(const TableEntry *entry) {
+    return (int) (int32_t) (uint32_t) (entry->data & 0xFFFFFFFFULL);
+}
+
+int tableEntryDepth(const TableEntry *entry) {
+    return (int) ((entry->data >> 32) & 0xFF);
+}
+
+BoundType tableEntryBound(const TableEntry *entry) {
+    return (BoundType) ((entry->data >> 40) & 0x3);
+}
+
+int tableEntryMove(const TableEntry *entry) {
+    int move = (int) ((entry->data >> 42) & 0xF);
+    return (move == 0xF) ? -1 : move;
+}
+
+unsigned int tableEntryGeneration(const TableEntry *entry) {
+    return (unsigned int) ((entry->data >> 48) & 0xFF);
+}
+
+/*
+ * Probe table
+ * - Used to look up key in the transposition table
+ * - Returns 1 and a copy of the entry if the position was stored
+ * - The entry is read without locks; see TableEntry
+ */
+int probeTable(TransTable *table, uint64_t key, TableEntry *entry, TableStats *stats) {
+    TableEntry *bucket = table->entries + (key & (table->numBuckets - 1)) * TABLE_BUCKET_SIZE;
+    uint64_t check, data;
+    int i;
+
+    stats->probes++;
+    for (i=0; i < TABLE_BUCKET_SIZE; i++) {
+        data = __atomic_load_n(&bucket[i].data, __ATOMIC_RELAXED);
+        check = __atomic_load_n(&bucket[i].check, __ATOMIC_RELAXED);
+        if (data != 0 && (check ^ data) == key) {
+            entry->check = check;
+            entry->data = data;
+            stats->hits++;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Store table
+ * - Used to store the search result of key in the transposition table
+ * - An entry of the same position is always overwritten
+ * - Otherwise the replaced entry is the empty one or the one with the lowest
+ *   depth, where every generation of age counts as 4 plies less
+ * - move is the best column, or -1 if there's none
+ */
+void storeTable(TransTable *table, uint64_t key, int score, int depth, BoundType bound, int move,
+                TableStats *stats) {
+    TableEntry *bucket = table->entries + (key & (table->numBuckets - 1)) * TABLE_BUCKET_SIZE;
+    TableEntry *victim = NULL;
+    TableEntry entry;
+    int worth, lowestWorth = 0;
+    unsigned int age;
+    uint64_t data;
+    int i;
+
+    stats->stores++;
+    for (i=0; i < TABLE_BUCKET_SIZE; i++) {
+        entry.data = __atomic_load_n(&bucket[i].data, __ATOMIC_RELAXED);
+        entry.check = __atomic_load_n(&bucket[i].check, __ATOMIC_RELAXED);
+        if ((entry.check ^ entry.data) == key) {
+            victim = &bucket[i];
+            break;
+        }
+    }
+
+    if (victim == NULL) {
+        for (i=0; i < TABLE_BUCKET_SIZE; i++) {
+            entry.data = __atomic_load_n(&bucket[i].data, __ATOMIC_RELAXED);
+            if (entry.data == 0) {
+                victim = &bucket[i];
+                lowestWorth = 0;
+                break;
+            }
+            age = (table->generation - tableEntryGeneration(&entry)) & 0xFF;
+            worth = tableEntryDepth(&entry) - 4 * (int) age;
+            if (victim == NULL || worth < lowestWorth) {
+                victim = &bucket[i];
+                lowestWorth = worth;
+            }
+        }
+        if (__atomic_load_n(&victim->data, __ATOMIC_RELAXED) != 0) {
+            stats->collisions++;
+        }
+    }
+
+    data = ((uint64_t) (uint32_t) score) |
+           (((uint64_t) (depth & 0xFF)) << 32) |
+           (((uint64_t) bound) << 40) |
+           (((uint64_t) (move & 0xF)) << 42) |
+           (((uint64_t) (table->generation & 0xFF)) << 48);
+    __atomic_store_n(&victim->data, data, __ATOMIC_RELAXED);
+    __atomic_store_n(&victim->check, key ^ data, __ATOMIC_RELAXED);
+}
+
+/*
+ * Clear table
+ * - Used to empty the transposition table and reset its statistics
+ */
+void clearTable(TransTable *table) {
+    memset(table->entries, 0, table->numBuckets * TABLE_BUCKET_SIZE * sizeof(TableEntry));
+    memset(&table->stats, 0, sizeof(TableStats));
+    table->generation = 0;
+}
+
+/*
+ * Add table stats
+ * - Used to add the statistics of from into to
+ */
+void addTableStats(TableStats *to, const TableStats *from) {
+    to->probes += from->probes;
+    to->hits += from->hits;
+    to->stores += from->stores;
+    to->collisions += from->collisions;
+}
+
+/*
+ * Print table stats
+ * - Used to print the hit rate and the collision rate of the transposition table
+ */
+void printTableStats(TransTable *table) {
+    TableStats *stats = &table->stats;
+
+    printf("Transposition table: %ld probes, %ld hits (%.1f%%), %ld stores, %ld collisions (%.1f%%)\n",
+           stats->probes, stats->hits,
+           (stats->probes > 0) ? (100.0 * stats->hits / stats->probes) : 0.0,
+           stats->stores, stats->collisions,
+           (stats->stores > 0) ? (100.0 * stats->collisions / stats->stores) : 0.0);
+}
+
+/*
+ * Zobrist check
+ * - Used to return a digest of zobristKeys stored in the book files
+ */
+uint64_t zobristCheck(void) {
+    uint64_t check = 0;
+    int i;
+
+    initZobrist();
+    for (i=0; i < 64; i++) {
+        check = (check * 31) ^ zobristKeys[0][i];
+        check = (check * 31) ^ zobristKeys[1][i];
+    }
+
+    return check;
+}
+
+/*
+ * Book entry packing
+ * - Used to pack and unpack the best column, depth and score of a book entry
+ */
+uint32_t bookPackEntry(int column, int depth, int score) {
+    return ((uint32_t) (column & 0xF)) |
+           (((uint32_t) (depth & 0x3F)) << 4) |
+           (((uint32_t) score) << 10);
+}
+
+int bookEntryColumn(uint32_t entry) {
+    return (int) (entry & 0xF);
+}
+
+int bookEntryDepth(uint32_t entry) {
+    return (int) ((entry >> 4) & 0x3F);
+}
+
+int bookEntryScore(uint32_t entry) {
+    return ((int32_t) entry) >> 10;
+}
+
+/*
+ * Open book
+ * - Used to map the book file at path into memory
+ * - The file is checked against the board size and the Zobrist keys
+ * - Nothing is read up front, so opening a book costs the same whatever its size
+ * - Returns 0 if the file cannot be mapped or is not a valid book
+ */
+int openBook(Book *book, const char *path, int width, int height) {
+    BookHeader header;
+    struct stat st;
+    int fd;
+    int success = 0;
+
+    memset(book, 0, sizeof(Book));
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    if (fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(BookHeader)) {
+        book->map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (book->map == MAP_FAILED) {
+            book->map = NULL;
+        }
+        else {
+            book->mapSize = (size_t) st.st_size;
+            memcpy(&header, book->map, sizeof(BookHeader));
+            if (memcmp(header.magic, BOOK_MAGIC, sizeof(BOOK_MAGIC)) == 0 &&
+                header.version == BOOK_VERSION &&
+                header.width == width && header.height == height &&
+                header.zobristCheck == zobristCheck() &&
+                book->mapSize == sizeof(BookHeader) + header.count * (sizeof(uint64_t) + sizeof(uint32_t))) {
+                book->count = header.count;
+                book->keys = (const uint64_t *) ((const char *) book->map + sizeof(BookHeader));
+                book->entries = (const uint32_t *) (book->keys + book->count);
+                success = 1;
+            }
+        }
+    }
+    close(fd);
+
+    if (!success && book->map != NULL) {
+        munmap(book->map, book->mapSize);
+        memset(book, 0, sizeof(Book));
+    }
+
+    return success;
+}
+
+/*
+ * Close book
+ * - Used to unmap the book file
+ */
+void closeBook(Book *book) {
+    if (book->map != NULL) {
+        munmap(book->map, book->mapSize);
+    }
+    memset(book, 0, sizeof(Book));
+}
+
+/*
+ * Probe book
+ * - Used to look up key in the book with a binary search
+ * - Returns 1 and the entry if the position is in the book
+ */
+int probeBook(const Book *book, uint64_t key, uint32_t *entry) {
+    uint64_t low = 0;
+    uint64_t high = book->count;
+    uint64_t middle;
+
+    while (low < high) {
+        middle = low + (high - low) / 2;
+        if (book->keys[middle] < key) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+    if (low < book->count && book->keys[low] == key) {
+        *entry = book->entries[low];
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Result of the move leading to an MctsNode */
+#define MCTS_OPEN  0
+#define MCTS_WIN   1
+#define MCTS_TIE   2
+
+/*
+ * MCTS node structure
+ * - Used to hold one position of a Monte Carlo search tree, reached by column
+ * - visits is the number of playouts through the node and score their outcome
+ *   for the player who moved into it: 2 per win and 1 per tie
+ * - children is the index of the first child in the node pool, the others
+ *   follow it (0 while the node isn't expanded), numChildren their count
+ * - result is MCTS_WIN or MCTS_TIE if column ended the game, else MCTS_OPEN
+ */
+typedef struct MctsNode {
+    uint32_t      visits;
+    uint32_t      score;
+    uint32_t      children;
+    unsigned char numChildren;
+    unsigned char column;
+    unsigned char result;
+    unsigned char reserved;
+} MctsNode;
+
+/*
+ * MCTS tree structure
+ * - Used to run the Monte Carlo tree search of one thread (root parallel:
+ *   the trees of the threads are searched and grown independently)
+ * - nodes is a pool of capacity nodes allocated once with the engine, node 0
+ *   is the root; it's emptied at the start of every search
+ * - rng is the random number generator of the playouts of this tree
+ * - root is the position searched, maxPlayouts the playouts to run (0 for
+ *   no limit), deadline the time (see getTimeUs()) to stop at (0 for none)
+ *   and cancel a flag raised by another thread to abandon the search
+ * - playouts and maxDepth are the playouts run and the deepest node reached
+ */
+typedef struct MctsTree {
+    pthread_t  thread;
+    MctsNode  *nodes;
+    uint32_t   capacity;
+    uint32_t   numNodes;
+    Xoshiro    rng;
+    Position   root;
+    long       maxPlayouts;
+    long long  deadline;
+    const int *cancel;
+    long       playouts;
+    int        maxDepth;
+} MctsTree;
+
+/*
+ * Create MCTS trees
+ * - Used to allocate the trees of ENGINE_MCTS, one per thread, sharing
+ *   config.hashMB megabytes of nodes
+ * - Returns 0 if the memory can't be allocated
+ */
+int createMctsTrees(Engine *engine) {
+    const EngineConfig *config = &engine->config;
+    size_t capacity;
+    int numTrees = config->threads;
+    int i;
+
+    if (numTrees < 1) {
+        numTrees = 1;
+    }
+    else if (numTrees > MAX_SEARCH_THREADS) {
+        numTrees = MAX_SEARCH_THREADS;
+    }
+    capacity = ((size_t) config->hashMB << 20) / sizeof(MctsNode) / (size_t) numTrees;
+    if (capacity > UINT32_MAX) {
+        capacity = UINT32_MAX;
+    }
+    else if (capacity < MAX_BOARD_WIDTH + 1) {
+        capacity = MAX_BOARD_WIDTH + 1;
+    }
+
+    engine->trees = (MctsTree *) calloc((size_t) numTrees, sizeof(MctsTree));
+    if (engine->trees == NULL) {
+        return 0;
+    }
+    engine->numTrees = numTrees;
+    for (i=0; i < numTrees; i++) {
+        engine->trees[i].nodes = (MctsNode *) malloc(capacity * sizeof(MctsNode));
+        if (engine->trees[i].nodes == NULL) {
+            return 0;
+        }
+        engine->trees[i].capacity = (uint32_t) capacity;
+    }
+
+    return 1;
+}
+
+/*
+ * Delete MCTS trees
+ * - Free the trees of ENGINE_MCTS, including partially allocated ones
+ */
+void deleteMctsTrees(Engine *engine) {
+    int i;
+
+    if (engine->trees != NULL) {
+        for (i=0; i < engine->numTrees; i++) {
+            free(engine->trees[i].nodes);
+        }
+        free(engine->trees);
+        engine->trees = NULL;
+        engine->numTrees = 0;
+    }
+}
+
+/*
+ * Create engine
+ * - Used to create the AI from config
+ * - The transposition table is allocated with config->hashMB megabytes;
+ *   ENGINE_MCTS spends them on its trees instead and keeps a 1 MB table
+ * - The opening book config->bookFile is mapped if there's one. The engine
+ *   still works without it, so a book that fails to open is only reported.
+ */
+Engine *createEngine(const EngineConfig *config) {
+    Engine *engine = NULL;
+
+    engine = (Engine *) calloc(1, sizeof(Engine));
+    if (engine != NULL) {
+        engine->config = *config;
+        if (!createTable(&engine->table, (config->type == ENGINE_MCTS) ? 1 : config->hashMB)) {
+            free(engine);
+            engine = NULL;
+        }
+        else if (config->type == ENGINE_MCTS && !createMctsTrees(engine)) {
+            deleteMctsTrees(engine);
+            deleteTable(&engine->table);
+            free(engine);
+            engine = NULL;
+        }
+        else if (config->bookFile != NULL &&
+                 !openBook(&engine->book, config->bookFile, config->width, config->height)) {
+            fprintf(stderr, "Cannot use opening book %s\n", config->bookFile);
+        }
+    }
+
+    return engine;
+}
+
+/*
+ * Delete engine
+ * - Delete the engine and free all the allocated memories
+ */
+void deleteEngine(Engine *engine) {
+    if (engine != NULL) {
+        deleteTable(&engine->table);
+        deleteMctsTrees(engine);
+        closeBook(&engine->book);
+        free(engine);
+    }
+}
+
+/*
+ * Search context structure
+ * - Used to hold the state of one search
+ * - pos is a private copy of the position that is played and undone in place
+ * - table is the transposition table shared by all the positions of the search
+ * - nodes is the number of positions visited so far
+ * - cutoffs is the number of beta cutoffs so far, firstCutoffs the ones made by
+ *   the first move tried, threatCutoffs the positions cut by zugzwangBound()
+ * - stats counts the use of the table by this search
+ * - deadline is the time (see getTimeUs()) at which the search stops, 0 for none
+ * - sharedStop is a flag shared by all the threads of a search (NULL for none)
+ * - cancel is a flag raised by another thread to abandon the search (NULL for none)
+ * - stopped is set once the deadline is reached or sharedStop or cancel is
+ *   raised; all the scores computed after that are meaningless and are thrown away
+ * - id is the index of the thread, used to vary the order of the root moves
+ * - ordering is the set of move ordering heuristics (ORDER_*)
+ * - killers are the last two columns that caused a cutoff, per number of
+ *   discs on the board (-1 for none)
+ * - history is the cutoff score of every cell, per player
+ */
+typedef struct SearchContext {
+    Position    pos;
+    TransTable *table;
+    TableStats  stats;
+    long        nodes;
+    long        cutoffs;
+    long        firstCutoffs;
+    long        threatCutoffs;
+    long long   deadline;
+    int        *sharedStop;
+    const int  *cancel;
+    int         stopped;
+    int         id;
+    int         ordering;
+    signed char killers[MAX_ENTRIES + 1][2];
+    int         history[2][64];
+} SearchContext;
+
+/*
+ * Search thread structure
+ * - Used to run one iterative deepening search of a parallel search
+ * - ctx is the state of the thread; only the table and the stop flag are shared
+ * - maxDepth is the deepest iteration to search
+ * - result is the outcome of the deepest completed iteration
+ */
+typedef struct SearchThread {
+    pthread_t     thread;
+    SearchContext ctx;
+    int           maxDepth;
+    SearchResult  result;
+} SearchThread;
+
+/* Number of nodes between two checks of the deadline and the stop flag */
+#define DEADLINE_CHECK_NODES  1024
+
+/*
+ * Ordering keys
+ * - Sort keys of orderMoves(), the highest is tried first
+ * - History scores are halved before they reach ORDER_HISTORY_LIMIT, so they
+ *   always rank below the killers and the table move
+ */
+#define ORDER_TT_KEY         (1 << 30)
+#define ORDER_KILLER_KEY     (1 << 29)
+#define ORDER_HISTORY_LIMIT  (1 << 28)
+
+/*
+ * Get time
+ * - Used to return a monotonic time in microseconds
+ */
+long long getTimeUs(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((long long) now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+}
+
+/*
+ * Get time ns
+ * - Used to return a monotonic time in nanoseconds
+ */
+long long getTimeNs(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((long long) now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+/*
+ * Window evaluators
+ * - Used to score every four-in-a-row window (line) of a board for the
+ *   player whose discs are mine against the discs theirs
+ * - A window with discs of one player only is worth count^3 (1, 8, 27) to
+ *   that player; a window with discs of both is dead and worth nothing
+ * - The masks of lines are padded with empty windows to a multiple of 4, so
+ *   the vector versions load whole registers
+ * - evaluateWindowsScalar() is plain C, evaluateWindowsSse2() counts 2
+ *   windows and evaluateWindowsAvx2() 4 windows per instruction; all three
+ *   return the same score
+ */
+typedef int (*WindowEvaluator)(uint64_t mine, uint64_t theirs, const LineTable *lines);
+
+int evaluateWindowsScalar(uint64_t mine, uint64_t theirs, const LineTable *lines) {
+    int score = 0;
+    int i, count;
+
+    for (i=0; i < lines->numLines; i++) {
+        if ((theirs & lines->masks[i]) == 0) {
+            count = __builtin_popcountll(mine & lines->masks[i]);
+            score += count * count * count;
+        }
+        else if ((mine & lines->masks[i]) == 0) {
+            count = __builtin_popcountll(theirs & lines->masks[i]);
+            score -= count * count * count;
+        }
+    }
+
+    return score;
+}
+
+#ifdef HAVE_X86_SIMD
+/*
+ * SSE2 helpers
+ * - popCount64Sse2() returns the number of bits of each 64 bit lane of x
+ *   (SWAR count per byte, then the bytes of each lane are summed by psadbw)
+ * - windowScoresSse2() returns count^3 of the windows whose other side is empty
+ */
+static inline __m128i popCount64Sse2(__m128i x) {
+    const __m128i m1 = _mm_set1_epi8(0x55);
+    const __m128i m2 = _mm_set1_epi8(0x33);
+    const __m128i m4 = _mm_set1_epi8(0x0F);
+
+    x = _mm_sub_epi8(x, _mm_and_si128(_mm_srli_epi64(x, 1), m1));
+    x = _mm_add_epi8(_mm_and_si128(x, m2), _mm_and_si128(_mm_srli_epi64(x, 2), m2));
+    x = _mm_and_si128(_mm_add_epi8(x, _mm_srli_epi64(x, 4)), m4);
+    return _mm_sad_epu8(x, _mm_setzero_si128());
+}
+
+static inline __m128i windowScoresSse2(__m128i own, __m128i other) {
+    __m128i count = popCount64Sse2(own);
+    __m128i open = _mm_cmpeq_epi32(other, _mm_setzero_si128());
+
+    /* Both halves of a 64 bit lane must be empty */
+    open = _mm_and_si128(open, _mm_shuffle_epi32(open, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_and_si128(_mm_mul_epu32(_mm_mul_epu32(count, count), count), open);
+}
+
+int evaluateWindowsSse2(uint64_t mine, uint64_t theirs, const LineTable *lines) {
+    __m128i vMine = _mm_set1_epi64x((long long) mine);
+    __m128i vTheirs = _mm_set1_epi64x((long long) theirs);
+    __m128i total = _mm_setzero_si128();
+    __m128i masks, own, other;
+    int i;
+
+    for (i=0; i < lines->numLines; i += 2) {
+        masks = _mm_loadu_si128((const __m128i *) (lines->masks + i));
+        own = _mm_and_si128(masks, vMine);
+        other = _mm_and_si128(masks, vTheirs);
+        total = _mm_add_epi64(total, windowScoresSse2(own, other));
+        total = _mm_sub_epi64(total, windowScoresSse2(other, own));
+    }
+    total = _mm_add_epi64(total, _mm_unpackhi_epi64(total, total));
+
+    return (int) _mm_cvtsi128_si64(total);
+}
+
+/*
+ * AVX2 helpers
+ * - Same as the SSE2 helpers on 4 lanes, counting bits with a nibble lookup table
+ * - Compiled for AVX2 only, and only called if the CPU supports it
+ */
+__attribute__((target("avx2")))
+static inline __m256i popCount64Avx2(__m256i x) {
+    const __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                           0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low = _mm256_set1_epi8(0x0F);
+    __m256i counts = _mm256_add_epi8(_mm256_shuffle_epi8(table, _mm256_and_si256(x, low)),
+                                     _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi64(x, 4), low)));
+
+    return _mm256_sad_epu8(counts, _mm256_setzero_si256());
+}
+
+__attribute__((target("avx2")))
+static inline __m256i windowScoresAvx2(__m256i own, __m256i other) {
+    __m256i count = popCount64Avx2(own);
+    __m256i open = _mm256_cmpeq_epi64(other, _mm256_setzero_si256());
+
+    return _mm256_and_si256(_mm256_mul_epu32(_mm256_mul_epu32(count, count), count), open);
+}
+
+__attribute__((target("avx2")))
+int evaluateWindowsAvx2(uint64_t mine, uint64_t theirs, const LineTable *lines) {
+    __m256i vMine = _mm256_set1_epi64x((long long) mine);
+    __m256i vTheirs = _mm256_set1_epi64x((long long) theirs);
+    __m256i total = _mm256_setzero_si256();
+    __m256i masks, own, other;
+    __m128i sum;
+    int i;
+
+    for (i=0; i < lines->numLines; i += 4) {
+        masks = _mm256_loadu_si256((const __m256i *) (lines->masks + i));
+        own = _mm256_and_si256(masks, vMine);
+        other = _mm256_and_si256(masks, vTheirs);
+        total = _mm256_add_epi64(total, windowScoresAvx2(own, other));
+        total = _mm256_sub_epi64(total, windowScoresAvx2(other, own));
+    }
+    sum = _mm_add_epi64(_mm256_castsi256_si128(total), _mm256_extracti128_si256(total, 1));
+    sum = _mm_add_epi64(sum, _mm_unpackhi_epi64(sum, sum));
+
+    return (int) _mm_cvtsi128_si64(sum);
+}
+#endif
+
+/*
+ * Window evaluator selection
+ * - windowEvaluator is the evaluator used by evaluatePosition(), set once by
+ *   selectWindowEvaluator() before any search starts
+ * - "auto" picks the widest instruction set the CPU supports; "avx2", "sse2"
+ *   and "scalar" force one
+ * - Returns 0 if name is unknown or not supported by this CPU
+ */
+WindowEvaluator windowEvaluator = evaluateWindowsScalar;
+const char *windowEvaluatorName = "scalar";
+
+int selectWindowEvaluator(const char *name) {
+    int isAuto = (strcmp(name, "auto") == 0);
+
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if ((isAuto || strcmp(name, "avx2") == 0) && __builtin_cpu_supports("avx2")) {
+        windowEvaluator = evaluateWindowsAvx2;
+        windowEvaluatorName = "avx2";
+        return 1;
+    }
+    if ((isAuto || strcmp(name, "sse2") == 0) && __builtin_cpu_supports("sse2")) {
+        windowEvaluator = evaluateWindowsSse2;
+        windowEvaluatorName = "sse2";
+        return 1;
+    }
+#endif
+    if (isAuto || strcmp(name, "scalar") == 0) {
+        windowEvaluator = evaluateWindowsScalar;
+        windowEvaluatorName = "scalar";
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Evaluate position
+ * - Static evaluation used at the leaves of the search
+ * - Every window of the board is scored for both players by windowEvaluator;
+ *   discs near the center take part in more windows and are worth more
+ * - The score is from the point of view of the side to move
+ */
+int evaluatePosition(const Position *pos) {
+    int player = pos->numFilled & 1;
+
+    return windowEvaluator(pos->discs[player], pos->discs[player ^ 1], positionLines(pos));
+}
+
+/*
+ * Order moves
+ * - Used to fill columns with the playable columns of ctx->pos, best first
+ * - The columns are ranked by the heuristics of ctx->ordering: the table move
+ *   tableMove (-1 for none), then the killers of this ply, then the history
+ *   score of the cell each column plays
+ * - Columns ranked the same keep the center out order (ORDER_CENTER) or the
+ *   left to right order
+ * - Returns the number of columns
+ */
+int orderMoves(SearchContext *ctx, int tableMove, int *columns) {
+    Position *pos = &ctx->pos;
+    int player = pos->numFilled & 1;
+    int keys[MAX_BOARD_WIDTH];
+    int numColumns = 0;
+    int i, j, column, key;
+
+    for (i=0; i < pos->width; i++) {
+        column = (ctx->ordering & ORDER_CENTER) ? centerColumn(pos->width, i) : i;
+        if (!positionCanPlay(pos, column)) {
+            continue;
+        }
+        key = 0;
+        if ((ctx->ordering & ORDER_TT_MOVE) && column == tableMove) {
+            key = ORDER_TT_KEY;
+        }
+        else if ((ctx->ordering & ORDER_KILLERS) && column == ctx->killers[pos->numFilled][0]) {
+            key = ORDER_KILLER_KEY + 1;
+        }
+        else if ((ctx->ordering & ORDER_KILLERS) && column == ctx->killers[pos->numFilled][1]) {
+            key = ORDER_KILLER_KEY;
+        }
+        else if (ctx->ordering & ORDER_HISTORY) {
+            key = ctx->history[player][column * pos->stride + pos->heights[column]];
+        }
+        /* Insertion sort, stable so that ties keep the base order */
+        for (j=numColumns; j > 0 && keys[j - 1] < key; j--) {
+            keys[j] = keys[j - 1];
+            columns[j] = columns[j - 1];
+        }
+        keys[j] = key;
+        columns[j] = column;
+        numColumns++;
+    }
+
+    return numColumns;
+}
+
+/*
+ * Record cutoff
+ * - Used to update the killers and the history of ctx when column, searched
+ *   to depth plies, caused a beta cutoff
+ * - Deep cutoffs weigh more in the history (depth * depth)
+ */
+void recordCutoff(SearchContext *ctx, int column, int depth) {
+    Position *pos = &ctx->pos;
+    int player = pos->numFilled & 1;
+    int *score;
+    int i;
+
+    if ((ctx->ordering & ORDER_KILLERS) && ctx->killers[pos->numFilled][0] != column) {
+        ctx->killers[pos->numFilled][1] = ctx->killers[pos->numFilled][0];
+        ctx->killers[pos->numFilled][0] = (signed char) column;
+    }
+    if (ctx->ordering & ORDER_HISTORY) {
+        score = &ctx->history[player][column * pos->stride + pos->heights[column]];
+        *score += depth * depth;
+        if (*score >= ORDER_HISTORY_LIMIT / 2) {
+            for (i=0; i < 64; i++) {
+                ctx->history[0][i] /= 2;
+                ctx->history[1][i] /= 2;
+            }
+        }
+    }
+}
+
+/*
+ * Negamax
+ * - Depth limited negamax search with alpha-beta pruning
+ * - Returns the score of ctx->pos for the side to move within (alpha, beta)
+ * - An immediate win of the side to move is scored without going deeper
+ * - A full board is a tie and scores 0
+ * - zugzwangBound() caps beta and the static evaluation, so a position the
+ *   odd/even threats decide is cut without searching it
+ * - evaluatePosition() is used when depth reaches 0
+ * - Results are stored in the transposition table with their bound, so the
+ *   same position reached by another move order is not searched again
+ * - The deadline and the shared stop flag are checked every DEADLINE_CHECK_NODES
+ *   nodes. Once stopped, 0 is returned all the way up and nothing more is stored.
+ */
+int negamax(SearchContext *ctx, int depth, int alpha, int beta) {
+    Position *pos = &ctx->pos;
+    int player = pos->numFilled & 1;
+    int bestScore = -INFINITE_SCORE;
+    int bestMove = -1;
+    int tableMove = -1;
+    int alphaOrig = alpha;
+    int columns[MAX_BOARD_WIDTH];
+    int numColumns;
+    int maxScore;
+    int score;
+    int i, n;
+    TableEntry entry;
+    BoundType bound;
+
+    ctx->nodes++;
+    if ((ctx->nodes % DEADLINE_CHECK_NODES) == 0) {
+        if ((ctx->deadline != 0 && getTimeUs() >= ctx->deadline) ||
+            (ctx->sharedStop != NULL && __atomic_load_n(ctx->sharedStop, __ATOMIC_RELAXED)) ||
+            (ctx->cancel != NULL && __atomic_load_n(ctx->cancel, __ATOMIC_RELAXED))) {
+            ctx->stopped = 1;
+        }
+    }
+    if (ctx->stopped) {
+        return 0;
+    }
+
+    if (positionIsGameOver(pos)) {
+        return 0;
+    }
+    for (i=0; i < pos->width; i++) {
+        if (positionIsWinningMove(pos, i, player)) {
+            return WIN_SCORE - (pos->numFilled + 1);
+        }
+    }
+    maxScore = zugzwangBound(pos);
+    if (beta > maxScore) {
+        beta = maxScore;
+        if (alpha >= beta) {
+            ctx->threatCutoffs++;
+            return beta;
+        }
+    }
+    if (depth <= 0) {
+        score = evaluatePosition(pos);
+        return (score < maxScore) ? score : maxScore;
+    }
+
+    if (probeTable(ctx->table, positionKey(pos), &entry, &ctx->stats)) {
+        tableMove = canonicalColumn(pos, tableEntryMove(&entry));
+        if (tableEntryDepth(&entry) >= depth) {
+            score = tableEntryScore(&entry);
+            bound = tableEntryBound(&entry);
+            if (bound == BOUND_EXACT) {
+                return score;
+            }
+            else if (bound == BOUND_LOWER && score > alpha) {
+                alpha = score;
+            }
+            else if (bound == BOUND_UPPER && score < beta) {
+                beta = score;
+            }
+            if (alpha >= beta) {
+                return score;
+            }
+        }
+    }
+
+    numColumns = orderMoves(ctx, tableMove, columns);
+    for (n=0; n < numColumns; n++) {
+        i = columns[n];
+        positionDropDisc(pos, i, player);
+        score = -negamax(ctx, depth - 1, -beta, -alpha);
+        positionUndoDisc(pos, i);
+        if (ctx->stopped) {
+            return 0;
+        }
+
+        if (score > bestScore) {
+            bestScore = score;
+            bestMove = i;
+            if (score > alpha) {
+                alpha = score;
+                if (alpha >= beta) {
+                    ctx->cutoffs++;
+                    ctx->firstCutoffs += (n == 0);
+                    recordCutoff(ctx, i, depth);
+                    break;
+                }
+            }
+        }
+    }
+
+    if (bestScore <= alphaOrig) {
+        bound = BOUND_UPPER;
+    }
+    else if (bestScore >= beta) {
+        bound = BOUND_LOWER;
+    }
+    else {
+        bound = BOUND_EXACT;
+    }
+    storeTable(ctx->table, positionKey(pos), bestScore, depth, bound, canonicalColumn(pos, bestMove),
+               &ctx->stats);
+
+    return bestScore;
+}
+
+/*
+ * Search root
+ * - Used to search every column of ctx->pos to depth plies
+ * - The columns are ordered by orderMoves() and tried from the (ctx->id % n)-th
+ *   on, so that the threads of a parallel search start in different parts of
+ *   the tree
+ * - The best column and its score are returned in bestColumn and bestScore
+ * - Returns 0 if the search was stopped before it completed
+ */
+int searchRoot(SearchContext *ctx, int depth, int *bestColumn, int *bestScore) {
+    Position *pos = &ctx->pos;
+    int player = pos->numFilled & 1;
+    int alpha = -INFINITE_SCORE;
+    int tableMove = -1;
+    int columns[MAX_BOARD_WIDTH];
+    int numColumns;
+    int score;
+    int i, column;
+    TableEntry entry;
+
+    *bestColumn = -1;
+    *bestScore = -INFINITE_SCORE;
+
+    if (probeTable(ctx->table, positionKey(pos), &entry, &ctx->stats)) {
+        tableMove = canonicalColumn(pos, tableEntryMove(&entry));
+    }
+    numColumns = orderMoves(ctx, tableMove, columns);
+    for (i=0; i < numColumns; i++) {
+        column = columns[(i + ctx->id) % numColumns];
+        if (positionIsWinningMove(pos, column, player)) {
+            *bestColumn = column;
+            *bestScore = WIN_SCORE - (pos->numFilled + 1);
+            break;
+        }
+        positionDropDisc(pos, column, player);
+        score = -negamax(ctx, depth - 1, -INFINITE_SCORE, -alpha);
+        positionUndoDisc(pos, column);
+        if (ctx->stopped) {
+            return 0;
+        }
+
+        if (score > *bestScore) {
+            *bestScore = score;
+            *bestColumn = column;
+            if (score > alpha) {
+                alpha = score;
+            }
+        }
+    }
+    if (*bestColumn >= 0 && !ctx->stopped) {
+        storeTable(ctx->table, positionKey(pos), *bestScore, depth, BOUND_EXACT,
+                   canonicalColumn(pos, *bestColumn), &ctx->stats);
+    }
+
+    return 1;
+}
+
+/*
+ * Iterate search
+ * - Used to run the iterative deepening loop of one search thread
+ * - Threads with an odd id start one ply deeper, so that half of the threads
+ *   are always working on the next iteration
+ * - The deepest completed iteration is kept in st->result
+ * - Deepening stops early once the result is a forced win or loss
+ * - A thread that completes its search raises the shared stop flag
+ */
+void iterateSearch(SearchThread *st) {
+    SearchContext *ctx = &st->ctx;
+    int depth, column, score;
+
+    for (depth=1 + (ctx->id & 1); depth <= st->maxDepth; depth++) {
+        if (!searchRoot(ctx, depth, &column, &score)) {
+            return;
+        }
+        st->result.column = column;
+        st->result.score = score;
+        st->result.depth = depth;
+        if (score > WIN_THRESHOLD || score < -WIN_THRESHOLD) {
+            break;
+        }
+    }
+
+    if (ctx->sharedStop != NULL) {
+        __atomic_store_n(ctx->sharedStop, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/*
+ * Search thread main
+ * - Entry point of the helper threads of a parallel search
+ */
+void *searchThreadMain(void *arg) {
+    iterateSearch((SearchThread *) arg);
+    return NULL;
+}
+
+/*
+ * Search position
+ * - Used to find the best column of the side to move with iterative deepening
+ * - The search is deepened one ply at a time up to config->depth (or the
+ *   end of the game) and the best column of the last completed iteration is kept
+ * - If config->moveTime is set, the search stops at that deadline and the
+ *   unfinished iteration is thrown away
+ * - Before searching, the legal column closest to the center is picked, so a
+ *   legal move is returned even if not even the first iteration completes
+ * - With config->threads > 1 (Lazy SMP), helper threads run the same search
+ *   on their own copy of the position and share only the transposition table.
+ *   The calling thread is thread 0. The first thread to complete stops the
+ *   others and the deepest completed iteration of any thread is returned.
+ * - table is the transposition table, which is kept from one search to the next
+ * - Raising *cancel (if not NULL) from another thread stops the search as if
+ *   its deadline was reached
+ */
+void searchPosition(const Position *pos, const EngineConfig *config, TransTable *table, const int *cancel,
+                    SearchResult *result) {
+    SearchThread workers[MAX_SEARCH_THREADS];
+    long long start = getTimeUs();
+    int empty = pos->width * pos->height - pos->numFilled;
+    int numThreads = config->threads;
+    int stop = 0;
+    int best = 0;
+    int i, column;
+
+    if (numThreads < 1) {
+        numThreads = 1;
+    }
+    else if (numThreads > MAX_SEARCH_THREADS) {
+        numThreads = MAX_SEARCH_THREADS;
+    }
+    table->generation++;
+
+    result->column = -1;
+    result->score = 0;
+    result->depth = 0;
+    result->bookHit = 0;
+    result->solved = 0;
+    result->ponderHit = 0;
+    result->fast = 0;
+    for (i=0; i < pos->width; i++) {
+        column = centerColumn(pos->width, i);
+        if (positionCanPlay(pos, column)) {
+            result->column = column;
+            break;
+        }
+    }
+
+    for (i=0; i < numThreads; i++) {
+        memset(&workers[i].ctx, 0, sizeof(SearchContext));
+        workers[i].ctx.pos = *pos;
+        workers[i].ctx.table = table;
+        workers[i].ctx.deadline = (config->moveTime > 0) ? start + ((long long) config->moveTime) * 1000 : 0;
+        workers[i].ctx.sharedStop = (numThreads > 1) ? &stop : NULL;
+        workers[i].ctx.cancel = cancel;
+        workers[i].ctx.id = i;
+        workers[i].ctx.ordering = config->ordering;
+        memset(workers[i].ctx.killers, -1, sizeof(workers[i].ctx.killers));
+        workers[i].maxDepth = (config->depth < empty) ? config->depth : empty;
+        workers[i].result = *result;
+    }
+    for (i=1; i < numThreads; i++) {
+        if (pthread_create(&workers[i].thread, NULL, searchThreadMain, &workers[i]) != 0) {
+            numThreads = i;
+            break;
+        }
+    }
+    iterateSearch(&workers[0]);
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+    for (i=1; i < numThreads; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+
+    result->nodes = 1;
+    result->cutoffs = 0;
+    result->firstCutoffs = 0;
+    result->threatCutoffs = 0;
+    memset(&result->tableStats, 0, sizeof(TableStats));
+    for (i=0; i < numThreads; i++) {
+        if (workers[i].result.depth > workers[best].result.depth) {
+            best = i;
+        }
+        result->nodes += workers[i].ctx.nodes;
+        result->cutoffs += workers[i].ctx.cutoffs;
+        result->firstCutoffs += workers[i].ctx.firstCutoffs;
+        result->threatCutoffs += workers[i].ctx.threatCutoffs;
+        addTableStats(&result->tableStats, &workers[i].ctx.stats);
+        addTableStats(&table->stats, &workers[i].ctx.stats);
+    }
+    result->column = workers[best].result.column;
+    result->score = workers[best].result.score;
+    result->depth = workers[best].result.depth;
+    result->timeUs = getTimeUs() - start;
+}
+
+/*
+ * Solve negamax
+ * - Exhaustive negamax with alpha-beta pruning used to solve endgames
+ * - Returns the exact score of ctx->pos for the side to move within (alpha, beta):
+ *   WIN_SCORE minus the number of discs when the game is won, its negation
+ *   when it's lost and 0 for a tie
+ * - There's no depth limit and no static evaluation, and the moves are made
+ *   and undone in place on ctx->pos, so nothing is allocated
+ * - A win can't come before our next move, which bounds beta; two immediate
+ *   threats of the opponent are a loss, and a single one must be blocked
+ * - zugzwangBound() may bound beta further from the odd/even threats
+ * - Moves played right below a threat of the opponent are skipped (they lose
+ *   at once); if nothing else is left the position is lost, otherwise the
+ *   opponent can't win before its second move, which bounds alpha
+ * - The moves are tried by the number of threats they leave us, most first
+ * - Results are stored with depth = number of empty cells, so they are
+ *   exact for negamax() as well
+ */
+int solveNegamax(SearchContext *ctx, int alpha, int beta) {
+    Position *pos = &ctx->pos;
+    int player = pos->numFilled & 1;
+    int empty = pos->width * pos->height - pos->numFilled;
+    int bestScore = -INFINITE_SCORE;
+    int bestMove = -1;
+    int alphaOrig;
+    int forced = -1;
+    int tried = 0;
+    int threats = 0;
+    uint64_t opponentThreats, cell;
+    int columns[MAX_BOARD_WIDTH];
+    int counts[MAX_BOARD_WIDTH];
+    int numColumns = 0;
+    int maxScore;
+    int score, count;
+    int i, n, column;
+    TableEntry entry;
+    BoundType bound;
+
+    ctx->nodes++;
+    if ((ctx->nodes % DEADLINE_CHECK_NODES) == 0 &&
+        ((ctx->deadline != 0 && getTimeUs() >= ctx->deadline) ||
+         (ctx->cancel != NULL && __atomic_load_n(ctx->cancel, __ATOMIC_RELAXED)))) {
+        ctx->stopped = 1;
+    }
+    if (ctx->stopped) {
+        return 0;
+    }
+
+    if (empty == 0) {
+        return 0;
+    }
+    for (i=0; i < pos->width; i++) {
+        if (positionIsWinningMove(pos, i, player)) {
+            return WIN_SCORE - (pos->numFilled + 1);
+        }
+    }
+    for (i=0; i < pos->width; i++) {
+        if (positionIsWinningMove(pos, i, player ^ 1)) {
+            threats++;
+            forced = i;
+        }
+    }
+    if (threats > 1) {
+        return -(WIN_SCORE - (pos->numFilled + 2));
+    }
+
+    maxScore = WIN_SCORE - (pos->numFilled + 3);
+    if (beta > maxScore) {
+        beta = maxScore;
+        if (alpha >= beta) {
+            return beta;
+        }
+    }
+    maxScore = zugzwangBound(pos);
+    if (beta > maxScore) {
+        beta = maxScore;
+        if (alpha >= beta) {
+            ctx->threatCutoffs++;
+            return beta;
+        }
+    }
+
+    opponentThreats = positionThreats(pos, pos->discs[player ^ 1]);
+    for (i=0; i < pos->width; i++) {
+        column = (forced >= 0) ? forced : centerColumn(pos->width, i);
+        if (positionCanPlay(pos, column) &&
+            (pos->heights[column] + 1 >= pos->height ||
+             (positionCell(pos, column, pos->heights[column] + 1) & opponentThreats) == 0)) {
+            cell = positionCell(pos, column, pos->heights[column]);
+            count = __builtin_popcountll(positionThreats(pos, pos->discs[player] | cell) & ~cell);
+            for (n=numColumns; n > 0 && counts[n - 1] < count; n--) {
+                columns[n] = columns[n - 1];
+                counts[n] = counts[n - 1];
+            }
+            columns[n] = column;
+            counts[n] = count;
+            numColumns++;
+        }
+        if (forced >= 0) {
+            break;
+        }
+    }
+
+    maxScore = -(WIN_SCORE - (pos->numFilled + 4));
+    if (numColumns == 0) {
+        return -(WIN_SCORE - (pos->numFilled + 2));
+    }
+    if (alpha < maxScore) {
+        alpha = maxScore;
+        if (alpha >= beta) {
+            return alpha;
+        }
+    }
+
+    if (probeTable(ctx->table, positionKey(pos), &entry, &ctx->stats) && tableEntryDepth(&entry) >= empty) {
+        score = tableEntryScore(&entry);
+        bound = tableEntryBound(&entry);
+        if (bound == BOUND_EXACT) {
+            return score;
+        }
+        else if (bound == BOUND_LOWER && score > alpha) {
+            alpha = score;
+        }
+        else if (bound == BOUND_UPPER && score < beta) {
+            beta = score;
+        }
+        if (alpha >= beta) {
+            return score;
+        }
+    }
+    alphaOrig = alpha;
+
+    for (n=0; n < numColumns; n++) {
+        column = columns[n];
+        positionDropDisc(pos, column, player);
+        tried++;
+        score = -solveNegamax(ctx, -beta, -alpha);
+        positionUndoDisc(pos, column);
+        if (ctx->stopped) {
+            return 0;
+        }
+
+        if (score > bestScore) {
+            bestScore = score;
+            bestMove = column;
+            if (score > alpha) {
+                alpha = score;
+                if (alpha >= beta) {
+                    ctx->cutoffs++;
+                    ctx->firstCutoffs += (tried == 1);
+                    break;
+                }
+            }
+        }
+    }
+
+    if (bestScore <= alphaOrig) {
+        bound = BOUND_UPPER;
+    }
+    else if (bestScore >= beta) {
+        bound = BOUND_LOWER;
+    }
+    else {
+        bound = BOUND_EXACT;
+    }
+    storeTable(ctx->table, positionKey(pos), bestScore, empty, bound, canonicalColumn(pos, bestMove),
+               &ctx->stats);
+
+    return bestScore;
+}
+
+/*
+ * Solve position
+ * - Used to find the best column of the side to move with the exact solver
+ * - result->score is the exact score (see solveNegamax()) and result->depth
+ *   the number of plies to the end of the game with the best play of both sides
+ * - If config->moveTime is set and the solver does not finish in half of it,
+ *   the position is searched with searchPosition() in the time left
+ * - Raising *cancel (if not NULL) stops the solver like the deadline
+ */
+void solvePosition(const Position *pos, const EngineConfig *config, TransTable *table, const int *cancel,
+                   SearchResult *result) {
+    SearchContext ctx;
+    EngineConfig searchConfig;
+    long long start = getTimeUs();
+    int player = pos->numFilled & 1;
+    int alpha = -INFINITE_SCORE;
+    int score, i, column;
+
+    memset(&ctx, 0, sizeof(SearchContext));
+    ctx.pos = *pos;
+    ctx.table = table;
+    ctx.cancel = cancel;
+    ctx.deadline = (config->moveTime > 0) ? start + ((long long) config->moveTime) * 500 : 0;
+    table->generation++;
+
+    memset(result, 0, sizeof(SearchResult));
+    result->column = -1;
+    result->score = -INFINITE_SCORE;
+    for (i=0; i < pos->width && !ctx.stopped; i++) {
+        column = centerColumn(pos->width, i);
+        if (positionCanPlay(&ctx.pos, column)) {
+            if (positionIsWinningMove(&ctx.pos, column, player)) {
+                result->column = column;
+                result->score = WIN_SCORE - (pos->numFilled + 1);
+                break;
+            }
+            positionDropDisc(&ctx.pos, column, player);
+            score = -solveNegamax(&ctx, -INFINITE_SCORE, -alpha);
+            positionUndoDisc(&ctx.pos, column);
+
+            if (!ctx.stopped && score > result->score) {
+                result->score = score;
+                result->column = column;
+                if (score > alpha) {
+                    alpha = score;
+                }
+            }
+        }
+    }
+    addTableStats(&table->stats, &ctx.stats);
+
+    if (ctx.stopped) {
+        searchConfig = *config;
+        searchConfig.moveTime = config->moveTime - (int) ((getTimeUs() - start) / 1000);
+        if (searchConfig.moveTime < 1) {
+            searchConfig.moveTime = 1;
+        }
+        searchPosition(pos, &searchConfig, table, cancel, result);
+        result->nodes += ctx.nodes;
+    }
+    else {
+        result->solved = 1;
+        result->nodes = ctx.nodes + 1;
+        if (result->score == 0) {
+            result->depth = pos->width * pos->height - pos->numFilled;
+        }
+        else {
+            result->depth = WIN_SCORE - abs(result->score) - pos->numFilled;
+        }
+    }
+    result->cutoffs += ctx.cutoffs;
+    result->firstCutoffs += ctx.firstCutoffs;
+    result->threatCutoffs += ctx.threatCutoffs;
+    addTableStats(&result->tableStats, &ctx.stats);
+    result->timeUs = getTimeUs() - start;
+}
+
+/* Weight of the exploration term of the UCT formula (see mctsSelect()) */
+#define MCTS_EXPLORATION  1.0
+
+/* Number of playouts between two checks of the deadline and the cancel flag */
+#define MCTS_CHECK_PLAYOUTS  256
+
+/*
+ * MCTS select
+ * - Used to return the index of the child of node to descend into
+ * - A child whose move wins is always taken, then the children never
+ *   visited in column order, then the best by UCT: the mean outcome of the
+ *   child plus MCTS_EXPLORATION * sqrt(ln(visits of node) / visits of child)
+ */
+uint32_t mctsSelect(const MctsTree *tree, const MctsNode *node) {
+    const MctsNode *child;
+    double logVisits = log((double) node->visits);
+    double value, bestValue = -1.0;
+    uint32_t best = node->children;
+    uint32_t unvisited = 0;
+    uint32_t index;
+    int i;
+
+    for (i=0; i < node->numChildren; i++) {
+        index = node->children + (uint32_t) i;
+        child = &tree->nodes[index];
+        if (child->result == MCTS_WIN) {
+            return index;
+        }
+        if (child->visits == 0) {
+            if (unvisited == 0) {
+                unvisited = index;
+            }
+            continue;
+        }
+        value = child->score / (2.0 * child->visits) +
+                MCTS_EXPLORATION * sqrt(logVisits / child->visits);
+        if (value > bestValue) {
+            bestValue = value;
+            best = index;
+        }
+    }
+
+    return (unvisited != 0) ? unvisited : best;
+}
+
+/*
+ * MCTS expand
+ * - Used to add the children of node index, the position pos, to the tree:
+ *   one per playable column, marked MCTS_WIN or MCTS_TIE if it ends the game
+ * - Returns 0 if the node pool is full, and the node stays a leaf
+ */
+int mctsExpand(MctsTree *tree, uint32_t index, const Position *pos) {
+    MctsNode *node = &tree->nodes[index];
+    MctsNode *child;
+    int player = pos->numFilled & 1;
+    int column;
+
+    if (tree->numNodes + (uint32_t) pos->width > tree->capacity) {
+        return 0;
+    }
+    node->children = tree->numNodes;
+    for (column=0; column < pos->width; column++) {
+        if (!positionCanPlay(pos, column)) {
+            continue;
+        }
+        child = &tree->nodes[tree->numNodes++];
+        memset(child, 0, sizeof(MctsNode));
+        child->column = (unsigned char) column;
+        if (positionIsWinningMove(pos, column, player)) {
+            child->result = MCTS_WIN;
+        }
+        else if (pos->numFilled + 1 == pos->width * pos->height) {
+            child->result = MCTS_TIE;
+        }
+        node->numChildren++;
+    }
+
+    return 1;
+}
+
+/*
+ * MCTS playout
+ * - Used to play pos to the end of the game with random moves, in place
+ * - The side to move wins at once if it has a playable threat, else it
+ *   blocks a playable threat of the other player, else it drops a disc in
+ *   a column drawn uniformly with rng
+ * - pos is a copy of a few bytes, so a playout allocates nothing
+ * - Returns the player who won or -1 for a tie
+ */
+int mctsPlayout(Position *pos, Xoshiro *rng) {
+    int columns[MAX_BOARD_WIDTH];
+    uint64_t playable, forced;
+    int player, numColumns, column;
+
+    while (!positionIsGameOver(pos)) {
+        player = pos->numFilled & 1;
+        playable = 0;
+        numColumns = 0;
+        for (column=0; column < pos->width; column++) {
+            if (pos->heights[column] < pos->height) {
+                columns[numColumns++] = column;
+                playable |= positionCell(pos, column, pos->heights[column]);
+            }
+        }
+        if ((positionThreats(pos, pos->discs[player]) & playable) != 0) {
+            return player;
+        }
+        forced = positionThreats(pos, pos->discs[player ^ 1]) & playable;
+        if (forced != 0) {
+            column = __builtin_ctzll(forced) / pos->stride;
+        }
+        else {
+            column = columns[xoshiroBelow(rng, numColumns)];
+        }
+        positionDropDisc(pos, column, player);
+    }
+
+    return -1;
+}
+
+/*
+ * MCTS run
+ * - Used to search tree->root until tree->maxPlayouts playouts are run, the
+ *   deadline is reached or *tree->cancel is raised
+ * - Each playout selects a path from the root with mctsSelect(), expands the
+ *   leaf once it has been visited, plays the game out with mctsPlayout()
+ *   (unless the leaf ended it) and adds the outcome to every node of the path
+ */
+void mctsRun(MctsTree *tree) {
+    uint32_t path[MAX_MOVES + 1];
+    Position pos;
+    MctsNode *node;
+    uint32_t index;
+    int rootPlayer = tree->root.numFilled & 1;
+    int depth, winner, mover, i;
+
+    memset(&tree->nodes[0], 0, sizeof(MctsNode));
+    tree->numNodes = 1;
+    tree->playouts = 0;
+    tree->maxDepth = 0;
+    while (tree->maxPlayouts == 0 || tree->playouts < tree->maxPlayouts) {
+        if ((tree->playouts % MCTS_CHECK_PLAYOUTS) == 0 &&
+            ((tree->deadline != 0 && getTimeUs() >= tree->deadline) ||
+             (tree->cancel != NULL && __atomic_load_n(tree->cancel, __ATOMIC_RELAXED)))) {
+            break;
+        }
+
+        pos = tree->root;
+        index = 0;
+        depth = 0;
+        path[0] = 0;
+        node = &tree->nodes[0];
+        while (node->numChildren > 0 && node->result == MCTS_OPEN) {
+            index = mctsSelect(tree, node);
+            node = &tree->nodes[index];
+            positionDropDisc(&pos, node->column, pos.numFilled & 1);
+            path[++depth] = index;
+        }
+        if (node->result == MCTS_OPEN && (index == 0 || node->visits > 0) &&
+            mctsExpand(tree, index, &pos)) {
+            index = mctsSelect(tree, node);
+            node = &tree->nodes[index];
+            positionDropDisc(&pos, node->column, pos.numFilled & 1);
+            path[++depth] = index;
+        }
+
+        if (node->result == MCTS_WIN) {
+            winner = (pos.numFilled - 1) & 1;
+        }
+        else if (node->result == MCTS_TIE) {
+            winner = -1;
+        }
+        else {
+            winner = mctsPlayout(&pos, &tree->rng);
+        }
+        for (i=0; i <= depth; i++) {
+            node = &tree->nodes[path[i]];
+            mover = rootPlayer ^ (~i & 1);
+            node->visits++;
+            node->score += (winner == mover) ? 2 : ((winner < 0) ? 1 : 0);
+        }
+        if (depth > tree->maxDepth) {
+            tree->maxDepth = depth;
+        }
+        tree->playouts++;
+    }
+}
+
+/*
+ * MCTS thread main
+ * - Entry point of the helper threads of a root parallel MCTS search
+ */
+void *mctsThreadMain(void *arg) {
+    mctsRun((MctsTree *) arg);
+    return NULL;
+}
+
+/*
+ * MCTS principal variation
+ * - Used to fill result->pv with result->column, then the most visited child
+ *   of each following node of tree
+ */
+void mctsPrincipalVariation(const MctsTree *tree, SearchResult *result) {
+    const MctsNode *node = &tree->nodes[0];
+    const MctsNode *child;
+    int column = result->column;
+    int length = 0;
+    int i;
+
+    while (column >= 0 && length < MAX_ENTRIES) {
+        result->pv[length++] = (char) ('A' + column);
+        child = NULL;
+        for (i=0; i < node->numChildren; i++) {
+            if (tree->nodes[node->children + i].column == column) {
+                child = &tree->nodes[node->children + i];
+            }
+        }
+        if (child == NULL || child->result != MCTS_OPEN) {
+            break;
+        }
+        node = child;
+        column = -1;
+        for (i=0; i < node->numChildren; i++) {
+            if (tree->nodes[node->children + i].visits > 0 &&
+                (column < 0 || tree->nodes[node->children + i].visits > child->visits)) {
+                child = &tree->nodes[node->children + i];
+                column = child->column;
+            }
+        }
+    }
+    result->pv[length] = '\0';
+}
+
+/*
+ * MCTS search
+ * - Used to find the best column of the side to move with ENGINE_MCTS
+ * - A winning column is played at once. Otherwise the trees of the engine
+ *   (one per thread, the calling thread is thread 0) search the position
+ *   independently with config.playouts shared between them, or until
+ *   config.moveTime, and the column most visited over all the trees is played
+ * - The generator of each tree is seeded from searchSeed() and the index of
+ *   the tree, so with a playout budget the search is reproducible
+ * - score is the mean outcome of that column in per mille, from -1000 (lost
+ *   every playout) to 1000 (won every playout); depth is the deepest node
+ *   reached and nodes the number of playouts
+ * - Raising *cancel (if not NULL) stops the search early
+ */
+void mctsSearch(Engine *engine, const Position *pos, const int *cancel, SearchResult *result) {
+    long visits[MAX_BOARD_WIDTH];
+    long scores[MAX_BOARD_WIDTH];
+    const EngineConfig *config = &engine->config;
+    long long start = getTimeUs();
+    int player = pos->numFilled & 1;
+    int numThreads = engine->numTrees;
+    uint64_t seed = searchSeed(config->seed, pos->key);
+    MctsTree *tree;
+    MctsNode *child;
+    int i, j, column;
+
+    memset(result, 0, sizeof(SearchResult));
+    memset(visits, 0, sizeof(visits));
+    memset(scores, 0, sizeof(scores));
+    result->column = -1;
+    for (i=0; i < pos->width; i++) {
+        column = centerColumn(pos->width, i);
+        if (positionIsWinningMove(pos, column, player)) {
+            result->column = column;
+            result->score = 1000;
+            result->pv[0] = (char) ('A' + column);
+            result->timeUs = getTimeUs() - start;
+            return;
+        }
+        if (result->column < 0 && positionCanPlay(pos, column)) {
+            result->column = column;
+        }
+    }
+    if (result->column < 0) {
+        return;
+    }
+
+    for (i=0; i < numThreads; i++) {
+        tree = &engine->trees[i];
+        xoshiroSeed(&tree->rng, splitMix64(&seed));
+        tree->root = *pos;
+        tree->maxPlayouts = (config->playouts > 0) ?
+                            (config->playouts + numThreads - 1) / numThreads : 0;
+        tree->deadline = (config->moveTime > 0) ? start + ((long long) config->moveTime) * 1000 : 0;
+        tree->cancel = cancel;
+    }
+    for (i=1; i < numThreads; i++) {
+        if (pthread_create(&engine->trees[i].thread, NULL, mctsThreadMain, &engine->trees[i]) != 0) {
+            numThreads = i;
+            break;
+        }
+    }
+    mctsRun(&engine->trees[0]);
+    for (i=1; i < numThreads; i++) {
+        pthread_join(engine->trees[i].thread, NULL);
+    }
+
+    for (i=0; i < numThreads; i++) {
+        tree = &engine->trees[i];
+        for (j=0; j < tree->nodes[0].numChildren; j++) {
+            child = &tree->nodes[tree->nodes[0].children + j];
+            visits[child->column] += child->visits;
+            scores[child->column] += child->score;
+        }
+        result->playouts += tree->playouts;
+        if (tree->maxDepth > result->depth) {
+            result->depth = tree->maxDepth;
+        }
+    }
+    for (column=0; column < pos->width; column++) {
+        if (visits[column] > visits[result->column]) {
+            result->column = column;
+        }
+    }
+    if (visits[result->column] > 0) {
+        result->score = (int) (1000 * scores[result->column] / visits[result->column]) - 1000;
+    }
+    result->nodes = result->playouts;
+    mctsPrincipalVariation(&engine->trees[0], result);
+    result->timeUs = getTimeUs() - start;
+}
+
+/*
+ * Read principal variation
+ * - Used to fill result->pv with the best line from pos: result->column,
+ *   then the best move stored in table for each following position
+ * - The line stops at the end of the game, at the first position missing
+ *   from the table, or after result->depth plies (deeper moves weren't searched)
+ */
+void readPrincipalVariation(TransTable *table, const Position *pos, SearchResult *result) {
+    Position next = *pos;
+    TableEntry entry;
+    TableStats stats;
+    int column = result->column;
+    int length = 0;
+
+    memset(&stats, 0, sizeof(TableStats));
+    while (column >= 0 && positionCanPlay(&next, column) && length < MAX_ENTRIES &&
+           (length == 0 || length < result->depth)) {
+        result->pv[length++] = (char) ('A' + column);
+        if (positionIsWinningMove(&next, column, next.numFilled & 1)) {
+            break;
+        }
+        positionDropDisc(&next, column, next.numFilled & 1);
+        column = probeTable(table, positionKey(&next), &entry, &stats) ?
+                 canonicalColumn(&next, tableEntryMove(&entry)) : -1;
+    }
+    result->pv[length] = '\0';
+}
+
+/*
+ * Engine search
+ * - Used to find the best column of the side to move with engine
+ * - ENGINE_FAST uses fastNextMove() and ENGINE_MCTS mctsSearch(); for
+ *   ENGINE_SEARCH the opening book is looked up first and the position is
+ *   searched only if it's not in the book
+ * - Once there are config.solveBelow empty cells or less, the position is
+ *   solved exactly instead of searched
+ * - Raising *cancel (if not NULL) abandons the search; the result is then
+ *   meaningless
+ * - The principal variation is read back from the table once done (from the
+ *   trees for ENGINE_MCTS)
+ */
+void engineSearch(Engine *engine, const Position *pos, const int *cancel, SearchResult *result) {
+    uint32_t entry;
+
+    if (engine->config.type == ENGINE_FAST) {
+        memset(result, 0, sizeof(SearchResult));
+        xoshiroSeed(&engine->rng, searchSeed(engine->config.seed, pos->key));
+        result->column = fastNextMove(pos, &engine->rng);
+        result->fast = 1;
+    }
+    else if (engine->config.type == ENGINE_MCTS) {
+        mctsSearch(engine, pos, cancel, result);
+        return;
+    }
+    else if (engine->book.map != NULL && probeBook(&engine->book, positionKey(pos), &entry) &&
+        positionCanPlay(pos, canonicalColumn(pos, bookEntryColumn(entry)))) {
+        memset(result, 0, sizeof(SearchResult));
+        result->column = canonicalColumn(pos, bookEntryColumn(entry));
+        result->score = bookEntryScore(entry);
+        result->depth = bookEntryDepth(entry);
+        result->bookHit = 1;
+    }
+    else if (pos->width * pos->height - pos->numFilled <= engine->config.solveBelow) {
+        solvePosition(pos, &engine->config, &engine->table, cancel, result);
+    }
+    else {
+        searchPosition(pos, &engine->config, &engine->table, cancel, result);
+    }
+    readPrincipalVariation(&engine->table, pos, result);
+}
+
+/*
+ * Stats format
+ * - Used to select how reportSearch() writes the record of each AI decision
+ * - STATS_NONE writes nothing, STATS_TEXT one readable line and STATS_JSON
+ *   one JSON object per line
+ */
+typedef enum StatsFormat {
+                         STATS_NONE,
+                         STATS_TEXT,
+                         STATS_JSON
+} StatsFormat;
+
+/* Format of the search records, set once from the command line (--stats) */
+StatsFormat statsFormat = STATS_NONE;
+
+/*
+ * Search source
+ * - Used to name where the column of result comes from: ponder, book, solve,
+ *   search, mcts or fast
+ */
+const char *searchSource(const SearchResult *result) {
+    if (result->ponderHit) {
+        return "ponder";
+    }
+    if (result->fast) {
+        return "fast";
+    }
+    if (result->playouts > 0) {
+        return "mcts";
+    }
+    if (result->bookHit) {
+        return "book";
+    }
+    return result->solved ? "solve" : "search";
+}
+
+/*
+ * Report search
+ * - Used to write the record of one AI decision to stderr in statsFormat:
+ *   the ply (discs on the board of pos), move, source, score, depth, nodes,
+ *   nodes per second, time, beta cutoffs (rate per node, and the rate made
+ *   by the first move), table probes and hits and the principal variation
+ * - With STATS_NONE it returns at once, so it can be called after every move
+ * - Each record is a single write, so records of concurrent threads don't mix
+ */
+void reportSearch(const Position *pos, const SearchResult *result) {
+    double nps, cutoffRate, firstRate, hitRate;
+
+    if (statsFormat == STATS_NONE) {
+        return;
+    }
+    nps = (result->timeUs > 0) ? (result->nodes * 1000000.0 / result->timeUs) : 0.0;
+    cutoffRate = (result->nodes > 0) ? ((double) result->cutoffs / result->nodes) : 0.0;
+    firstRate = (result->cutoffs > 0) ? ((double) result->firstCutoffs / result->cutoffs) : 0.0;
+    hitRate = (result->tableStats.probes > 0) ?
+              ((double) result->tableStats.hits / result->tableStats.probes) : 0.0;
+
+    if (statsFormat == STATS_JSON) {
+        fprintf(stderr, "{\"ply\":%d,\"move\":\"%c\",\"source\":\"%s\",\"score\":%d,\"depth\":%d,"
+                "\"nodes\":%ld,\"nps\":%.0f,\"time_us\":%lld,\"cutoffs\":%ld,\"cutoff_rate\":%.4f,"
+                "\"first_cutoff_rate\":%.4f,\"threat_cutoffs\":%ld,\"tt_probes\":%ld,\"tt_hits\":%ld,\"tt_hit_rate\":%.4f,"
+                "\"pv\":\"%s\"}\n",
+                pos->numFilled, (char) ('A' + result->column), searchSource(result), result->score,
+                result->depth, result->nodes, nps, result->timeUs, result->cutoffs, cutoffRate,
+                firstRate, result->threatCutoffs, result->tableStats.probes, result->tableStats.hits, hitRate,
+                result->pv);
+    }
+    else {
+        fprintf(stderr, "ply %d: %c (%s) score %d depth %d nodes %ld nps %.0f time %.1f ms "
+                "cutoffs %.1f%% first %.1f%% threats %ld tt %ld/%ld (%.1f%%) pv %s\n",
+                pos->numFilled, (char) ('A' + result->column), searchSource(result), result->score,
+                result->depth, result->nodes, nps, result->timeUs / 1000.0, 100.0 * cutoffRate,
+                100.0 * firstRate, result->threatCutoffs, result->tableStats.hits, result->tableStats.probes, 100.0 * hitRate,
+                result->pv);
+    }
+}
+
+/*
+ * Engine next move
+ * - Used to find the best column of the side to move with engine (see
+ *   engineSearch())
+ */
+void engineNextMove(Engine *engine, const Position *pos, SearchResult *result) {
+    engineSearch(engine, pos, NULL, result);
+}
+
+/*
+ * Create ponder
+ * - Used to create the pondering state of engine, with no thread running
+ */
+Ponder *createPonder(Engine *engine) {
+    Ponder *ponder = (Ponder *) calloc(1, sizeof(Ponder));
+
+    if (ponder != NULL) {
+        ponder->engine = engine;
+        pthread_mutex_init(&ponder->lock, NULL);
+    }
+    return ponder;
+}
+
+/*
+ * Ponder main
+ * - Entry point of the pondering thread
+ * - Searches the position after each reply of ponder->columns in turn until
+ *   the reply actually played is known or all of them are done
+ */
+void *ponderMain(void *arg) {
+    Ponder *ponder = (Ponder *) arg;
+    Position pos;
+    SearchResult result;
+    int i, column;
+
+    pthread_mutex_lock(&ponder->lock);
+    for (i=0; i < ponder->numColumns && ponder->target < 0; i++) {
+        column = ponder->columns[i];
+        ponder->current = column;
+        pthread_mutex_unlock(&ponder->lock);
+
+        pos = ponder->pos;
+        positionDropDisc(&pos, column, pos.numFilled & 1);
+        engineSearch(ponder->engine, &pos, &ponder->cancel, &result);
+
+        pthread_mutex_lock(&ponder->lock);
+        ponder->current = -1;
+        if (!__atomic_load_n(&ponder->cancel, __ATOMIC_RELAXED)) {
+            ponder->results[column] = result;
+            ponder->searched |= 1u << column;
+        }
+    }
+    pthread_mutex_unlock(&ponder->lock);
+
+    return NULL;
+}
+
+/*
+ * Stop ponder
+ * - Used to cancel the pondering thread, if running, and wait for it
+ */
+void stopPonder(Ponder *ponder) {
+    if (ponder == NULL || !ponder->running) {
+        return;
+    }
+    pthread_mutex_lock(&ponder->lock);
+    ponder->target = MAX_BOARD_WIDTH;
+    __atomic_store_n(&ponder->cancel, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&ponder->lock);
+    pthread_join(ponder->thread, NULL);
+    ponder->running = 0;
+}
+
+/*
+ * Start ponder
+ * - Used to start pondering on pos, where the opponent of the engine is to move
+ * - The reply the engine expects (the best move of the table) is searched
+ *   first, then the others from the center out. Replies that end the game
+ *   are not searched.
+ * - Any pondering still running is stopped first
+ */
+void startPonder(Ponder *ponder, const Position *pos) {
+    TableEntry entry;
+    TableStats stats;
+    int player = pos->numFilled & 1;
+    int tableMove = -1;
+    int i, column;
+
+    if (ponder == NULL || ponder->engine->config.type != ENGINE_SEARCH) {
+        return;
+    }
+    stopPonder(ponder);
+    if (pos->numFilled + 1 >= pos->width * pos->height ||
+        positionHasFour(pos, pos->discs[player ^ 1])) {
+        return;
+    }
+
+    memset(&stats, 0, sizeof(TableStats));
+    if (probeTable(&ponder->engine->table, positionKey(pos), &entry, &stats)) {
+        tableMove = canonicalColumn(pos, tableEntryMove(&entry));
+    }
+    ponder->pos = *pos;
+    ponder->numColumns = 0;
+    for (i=-1; i < pos->width; i++) {
+        column = (i < 0) ? tableMove : centerColumn(pos->width, i);
+        if (column >= 0 && (i < 0 || column != tableMove) && positionCanPlay(pos, column) &&
+            !positionIsWinningMove(pos, column, player)) {
+            ponder->columns[ponder->numColumns++] = column;
+        }
+    }
+    ponder->searched = 0;
+    ponder->current = -1;
+    ponder->target = -1;
+    ponder->cancel = 0;
+    if (ponder->numColumns > 0 && pthread_create(&ponder->thread, NULL, ponderMain, ponder) == 0) {
+        ponder->running = 1;
+    }
+}
+
+/*
+ * Finish ponder
+ * - Used once the opponent has moved, reaching pos, to stop pondering
+ * - The search of any other reply is cancelled. If the reply played is being
+ *   searched, that search is finished first.
+ * - Returns 1 with the answer in result if the reply was searched, with
+ *   result->timeUs the time waited for it; returns 0 otherwise
+ */
+int finishPonder(Ponder *ponder, const Position *pos, SearchResult *result) {
+    Position next;
+    long long start = getTimeUs();
+    int column = -1;
+    int i;
+
+    if (ponder == NULL || !ponder->running) {
+        return 0;
+    }
+    for (i=0; i < ponder->pos.width && column < 0; i++) {
+        next = ponder->pos;
+        if (positionCanPlay(&next, i)) {
+            positionDropDisc(&next, i, next.numFilled & 1);
+            if (next.discs[0] == pos->discs[0] && next.discs[1] == pos->discs[1]) {
+                column = i;
+            }
+        }
+    }
+    if (column < 0) {
+        stopPonder(ponder);
+        return 0;
+    }
+
+    pthread_mutex_lock(&ponder->lock);
+    ponder->target = column;
+    if (ponder->current != column) {
+        __atomic_store_n(&ponder->cancel, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&ponder->lock);
+    pthread_join(ponder->thread, NULL);
+    ponder->running = 0;
+
+    if ((ponder->searched & (1u << column)) == 0) {
+        return 0;
+    }
+    *result = ponder->results[column];
+    result->timeUs = getTimeUs() - start;
+    result->ponderHit = 1;
+    return 1;
+}
+
+/*
+ * Delete ponder
+ * - Stop the pondering thread and free the pondering state
+ */
+void deletePonder(Ponder *ponder) {
+    if (ponder != NULL) {
+        stopPonder(ponder);
+        pthread_mutex_destroy(&ponder->lock);
+        free(ponder);
+    }
+}
+
+/*
+ * AI next move
+ * - Find the next move (i.e. column) for the computer
+ * - Dispatch to the engine selected by game->engine
+ * - The answer found while pondering is used if there's one
+ * - The search is reported with reportSearch()
+ */
+char getAINextMove(Game *game) {
+    char nextMove;
+    SearchResult result;
+
+    if (game->engine != NULL) {
+        if (!finishPonder(game->ponder, &game->position, &result)) {
+            engineNextMove(game->engine, &game->position, &result);
+        }
+        reportSearch(&game->position, &result);
+        game->lastSearch = result;
+        nextMove = (char) (result.column) + 'A';
+    }
+    else {
+        nextMove = (char) fastNextMove(&game->position, NULL) + 'A';
+    }
+
+    return nextMove;
+}
+
+/*
+ * Human next move
+ * - Prompt the user for the next move ('A' to the last column, or 'U' to take back)
+ */
+char getHumanNextMove(Game *game) {
+    char nextMove = 'A';
+    char carriageReturn;
+
+    printf("Enter column ('A' - '%c', 'U' to take back): ", 'A' + game->board->width - 1);
+    scanf("%c", &nextMove);
+    do {
+        scanf("%c", &carriageReturn);
+    } while (carriageReturn != '\n');
+
+    return nextMove;
+}
+
+/*
+ * Process human move
+ * - Process the human's next move by
+ *   1. Get the next move column
+ *   2. Drop the disc to the column
+ *   3. Determine if the human is the winner
+ * - 'U' takes back the computer's last move and the human's move before it
+*/
+int processHumanMove(Game *game, PlayerType *winner)
+{
+    int success = 0;
+    int retries = 0;
+    char next = ' ';
+    int won = 0;
+    char row;
+    int score = 0;
+
+    while (!success && retries < 5) {
+        next = getHumanNextMove(game);
+        if (next == 'U' && game->numMoves >= 2) {
+            unmakeMove(game);
+            unmakeMove(game);
+            game->numFilled -= 2;
+            printf("Human takes back the last move\n");
+            printBoard(game->board);
+            startPonder(game->ponder, &game->position);
+        }
+        else if (next >= 'A' && next < 'A' + game->board->width) {
+            success = dropDisc(game, next, game->humanDisc, &row, &won, &score);
+            if (success) {
+                if (won) {
+                    *winner = PLAYER_HUMAN;
+                }
+                printf("Human adds '%c' to [%c%c]\n", game->humanDisc, next, row);
+            }
+            else {
+                retries++;
+            }
+        }
+        else {
+            retries++;
+        }
+    }
+
+    return success;
+}
+
+/*
+ * Process AI move
+ * - Process the computer's next move by
+ *   1. Get the next move column
+ *   2. Drop the disc to the column
+ *   3. Determine if the computer is the winner
+ *   4. Ponder on the human's replies while it thinks
+ */
+int processAIMove(Game *game, PlayerType *winner)
+{
+    int success = 0;
+    int retries = 0;
+    char next = ' ';
+    int won = 0;
+    char row;
+    int score = 0;
+    while (!success && retries < 5) {
+        next = getAINextMove(game);
+        success = dropDisc(game, next, game->AIDisc, &row, &won, &score);
+        if (success) {
+            if (won) {
+                *winner = PLAYER_AI;
+            }
+            else {
+                startPonder(game->ponder, &game->position);
+            }
+            printf("Computer adds '%c' to [%c%c]\n", game->AIDisc, next, row);
+            if (game->engine != NULL && game->engine->config.type != ENGINE_FAST) {
+                if (game->lastSearch.ponderHit) {
+                    printf("Computer answered from pondering (depth %d) in %.1f ms\n",
+                           game->lastSearch.depth, game->lastSearch.timeUs / 1000.0);
+                }
+                else if (game->lastSearch.bookHit) {
+                    printf("Computer played from the opening book\n");
+                }
+                else if (game->lastSearch.solved) {
+                    printf("Computer solved the endgame in %.1f ms: %s in %d plies\n",
+                           game->lastSearch.timeUs / 1000.0,
+                           (game->lastSearch.score > 0) ? "win" :
+                           ((game->lastSearch.score < 0) ? "loss" : "tie"),
+                           game->lastSearch.depth);
+                }
+                else if (game->lastSearch.playouts > 0) {
+                    printf("Computer ran %ld playouts (%.0f per second) in %.1f ms\n",
+                           game->lastSearch.playouts,
+                           game->lastSearch.playouts * 1000000.0 /
+                           ((game->lastSearch.timeUs > 0) ? game->lastSearch.timeUs : 1),
+                           game->lastSearch.timeUs / 1000.0);
+                }
+                else {
+                    printf("Computer searched to depth %d in %.1f ms\n",
+                           game->lastSearch.depth, game->lastSearch.timeUs / 1000.0);
+                }
+            }
+        }
+        else {
+            retries++;
+        }
+    }
+
+    return success;
+}
+
+/*
+ * Print game stat
+ * - Print the game stat including
+ *   1. the board
+ *   2. the history list
+ *   3. the transposition table statistics of the search engine
+ */
+void gameStat(Game *game) {
+    int i;
+
+    printf("Finally board is\n");
+    printBoard(game->board);
+    printf("\n");
+
+    printf("Moves\n");
+    printf("[");
+    for (i=0; i < game->numMoves; i++) {
+        printf("%c", game->history[i].data);
+        printf("%s", (i + 1 < game->numMoves) ? "," : "]\n");
+    }
+
+    if (game->engine != NULL && game->engine->config.type == ENGINE_SEARCH) {
+        printTableStats(&game->engine->table);
+    }
+}
+
+/*
+ * Play game
+ * - Play the game
+ * - Starts with computer if it supposed to go first
+ * - Loop until the same is done (tie or a winner is found)
+ * - Human and computer are alternaing to play inside the loop
+ */
+int playGame(Game *game) {
+    int success = 0;
+    char nextMove = ' ';
+    int done = 0;
+    PlayerType winner = PLAYER_NONE;
+    if (game != NULL) {
+        success = 1;
+        if (game->firstPlayer == PLAYER_AI) {
+            success = processAIMove(game, &winner);
+            if (success && winner == PLAYER_NONE) {
+                game->numFilled++;
+                printBoard(game->board);
+            }
+        }
+
+        while (success && !done && winner == PLAYER_NONE) {
+            success = processHumanMove(game, &winner);
+            if (success && winner == PLAYER_NONE) {
+                game->numFilled++;
+                printBoard(game->board);
+            }
+            if (isGameOver(game)) {
+                printf("Game over!\n");
+                done = 1;
+            }
+
+            if (success && !done && winner == PLAYER_NONE) {
+                success = processAIMove(game, &winner);
+                if (success && winner == PLAYER_NONE) {
+                    game->numFilled++;
+                    printBoard(game->board);
+                }
+                if (isGameOver(game)) {
+                    printf("Game over!\n");
+                    done = 1;
+                }
+            }
+        }
+
+        if (!success) {
+            printf("Error while playing game\n");
+        }
+        else {
+            if (winner == PLAYER_AI) {
+                printBoard(game->board);
+                printf("Computer wins!\n");
+            }
+            else if (winner == PLAYER_HUMAN) {
+                printBoard(game->board);
+                printf("Human wins!\n");
+            }
+            gameStat(game);
+        }
+        stopPonder(game->ponder);
+    }
+    return success;
+}
+
+/* Magic and version of the game log files (see GameLogHeader) */
+#define GAME_LOG_MAGIC    "CF4GAME"
+#define GAME_LOG_VERSION  2
+
+/*
+ * Game result
+ * - Used to record how a game ended: not finished, won by 'X' or 'O', or tied
+ */
+typedef enum GameResult {
+                         RESULT_NONE,
+                         RESULT_X_WINS,
+                         RESULT_O_WINS,
+                         RESULT_TIE
+} GameResult;
+
+/*
+ * Game log header structure
+ * - Header at the start of a game log file, followed by the game records
+ */
+typedef struct GameLogHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t reserved;
+} GameLogHeader;
+
+/*
+ * Game record header structure
+ * - Header of one game of a game log, followed by its moves
+ * - size is the board width (high nibble) and height (low nibble)
+ * - flags packs the result (bits 0-1), the first player (bit 2, set if the
+ *   human played first) and the move ordering heuristics (bits 4-7)
+ * - engineType, depth and moveTime are the type (EngineType), search depth
+ *   and move time of the engine
+ * - The moves follow as column indexes packed in gameLogMoveBits() bits
+ *   each, least significant bits first, padded to a whole byte
+ */
+typedef struct GameRecordHeader {
+    unsigned char numMoves;
+    unsigned char size;
+    unsigned char flags;
+    unsigned char depth;
+    unsigned char engineType;
+    unsigned char reserved[3];
+    uint32_t      moveTime;
+} GameRecordHeader;
+
+/*
+ * Game record structure
+ * - Used to hold one game read back from a game log
+ * - columns are the column indexes played, 'X' first
+ */
+typedef struct GameRecord {
+    int           width;
+    int           height;
+    int           numMoves;
+    GameResult    result;
+    PlayerType    firstPlayer;
+    EngineType    engineType;
+    int           ordering;
+    int           depth;
+    int           moveTime;
+    unsigned char columns[MAX_MOVES];
+} GameRecord;
+
+/*
+ * Game log structure
+ * - Used to append game records to a game log file
+ * - games counts the records written; lock makes each record a single
+ *   write when games end on several threads
+ */
+typedef struct GameLog {
+    FILE           *file;
+    long            games;
+    pthread_mutex_t lock;
+} GameLog;
+
+/*
+ * Game log reader structure
+ * - Used to read the records of a game log file in order, mapped with mmap
+ * - offset is the position of the next record in the map
+ */
+typedef struct GameLogReader {
+    void          *map;
+    size_t         mapSize;
+    size_t         offset;
+} GameLogReader;
+
+/*
+ * Game log move bits
+ * - Used to return the number of bits of one move on a board of width
+ *   columns: 3 up to 8 columns, 4 for 9
+ */
+int gameLogMoveBits(int width) {
+    return (width <= 8) ? 3 : 4;
+}
+
+/*
+ * Position result
+ * - Used to return the result of the game at pos
+ */
+GameResult positionResult(const Position *pos) {
+    if (positionHasFour(pos, pos->discs[0])) {
+        return RESULT_X_WINS;
+    }
+    if (positionHasFour(pos, pos->discs[1])) {
+        return RESULT_O_WINS;
+    }
+    return positionIsGameOver(pos) ? RESULT_TIE : RESULT_NONE;
+}
+
+/*
+ * Open game log
+ * - Used to open the game log at path for appending, creating it if needed
+ * - Returns 0 if the file can't be opened or isn't a game log
+ */
+int openGameLog(GameLog *gameLog, const char *path) {
+    GameLogHeader header;
+
+    memset(gameLog, 0, sizeof(GameLog));
+    gameLog->file = fopen(path, "a+b");
+    if (gameLog->file == NULL) {
+        return 0;
+    }
+    if (fseek(gameLog->file, 0, SEEK_END) == 0 && ftell(gameLog->file) == 0) {
+        memset(&header, 0, sizeof(GameLogHeader));
+        memcpy(header.magic, GAME_LOG_MAGIC, sizeof(GAME_LOG_MAGIC));
+        header.version = GAME_LOG_VERSION;
+        if (fwrite(&header, sizeof(GameLogHeader), 1, gameLog->file) != 1) {
+            fclose(gameLog->file);
+            return 0;
+        }
+    }
+    else if (fseek(gameLog->file, 0, SEEK_SET) != 0 ||
+             fread(&header, sizeof(GameLogHeader), 1, gameLog->file) != 1 ||
+             memcmp(header.magic, GAME_LOG_MAGIC, sizeof(GAME_LOG_MAGIC)) != 0 ||
+             header.version != GAME_LOG_VERSION) {
+        fclose(gameLog->file);
+        return 0;
+    }
+    fseek(gameLog->file, 0, SEEK_END);
+    pthread_mutex_init(&gameLog->lock, NULL);
+    return 1;
+}
+
+/*
+ * Write game record
+ * - Used to append one game to gameLog
+ * - moves are the columns played ('A' to the last column), 'X' first
+ * - config is the engine of the computer
+ * - Returns 0 if the record couldn't be written
+ */
+int writeGameRecord(GameLog *gameLog, const char *moves, int numMoves, int width, int height,
+                    GameResult result, PlayerType firstPlayer, const EngineConfig *config) {
+    unsigned char buffer[sizeof(GameRecordHeader) + MAX_MOVES];
+    GameRecordHeader *header = (GameRecordHeader *) buffer;
+    unsigned char *packed = buffer + sizeof(GameRecordHeader);
+    int bits = gameLogMoveBits(width);
+    size_t size = sizeof(GameRecordHeader) + (size_t) ((numMoves * bits + 7) / 8);
+    int i, offset, success;
+
+    memset(buffer, 0, size);
+    header->numMoves = (unsigned char) numMoves;
+    header->size = (unsigned char) ((width << 4) | height);
+    header->flags = (unsigned char) (result | ((firstPlayer == PLAYER_HUMAN) ? 0x4 : 0) |
+                                     ((config->ordering & 0xF) << 4));
+    header->depth = (unsigned char) config->depth;
+    header->engineType = (unsigned char) config->type;
+    header->moveTime = (uint32_t) config->moveTime;
+    for (i=0; i < numMoves; i++) {
+        offset = i * bits;
+        packed[offset / 8] |= (unsigned char) ((moves[i] - 'A') << (offset % 8));
+        if (offset % 8 + bits > 8) {
+            packed[offset / 8 + 1] |= (unsigned char) ((moves[i] - 'A') >> (8 - offset % 8));
+        }
+    }
+
+    pthread_mutex_lock(&gameLog->lock);
+    success = (fwrite(buffer, size, 1, gameLog->file) == 1);
+    gameLog->games += success;
+    pthread_mutex_unlock(&gameLog->lock);
+
+    return success;
+}
+
+/*
+ * Log game
+ * - Used to append game to gameLog (if not NULL), with the engine config of the
+ *   computer
+ */
+void logGame(GameLog *gameLog, const Game *game, const EngineConfig *config) {
+    char moves[MAX_MOVES];
+    int i;
+
+    if (gameLog == NULL || game->numMoves == 0) {
+        return;
+    }
+    for (i=0; i < game->numMoves; i++) {
+        moves[i] = game->history[i].data;
+    }
+    writeGameRecord(gameLog, moves, game->numMoves, game->board->width, game->board->height,
+                    positionResult(&game->position), game->firstPlayer, config);
+}
+
+/*
+ * Close game log
+ * - Used to flush and close the game log
+ */
+void closeGameLog(GameLog *gameLog) {
+    if (gameLog->file != NULL) {
+        fclose(gameLog->file);
+        gameLog->file = NULL;
+        pthread_mutex_destroy(&gameLog->lock);
+    }
+}
+
+/*
+ * Open game log reader
+ * - Used to map the game log at path for reading
+ * - Returns 0 if the file can't be mapped or isn't a game log
+ */
+int openGameLogReader(GameLogReader *reader, const char *path) {
+    GameLogHeader header;
+    struct stat st;
+    int fd;
+    int success = 0;
+
+    memset(reader, 0, sizeof(GameLogReader));
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    if (fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(GameLogHeader)) {
+        reader->map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (reader->map == MAP_FAILED) {
+            reader->map = NULL;
+        }
+        else {
+            reader->mapSize = (size_t) st.st_size;
+            madvise(reader->map, reader->mapSize, MADV_SEQUENTIAL);
+            memcpy(&header, reader->map, sizeof(GameLogHeader));
+            if (memcmp(header.magic, GAME_LOG_MAGIC, sizeof(GAME_LOG_MAGIC)) == 0 &&
+                header.version == GAME_LOG_VERSION) {
+                reader->offset = sizeof(GameLogHeader);
+                success = 1;
+            }
+        }
+    }
+    close(fd);
+
+    if (!success && reader->map != NULL) {
+        munmap(reader->map, reader->mapSize);
+        memset(reader, 0, sizeof(GameLogReader));
+    }
+
+    return success;
+}
+
+/*
+ * Read game record
+ * - Used to read the next game of reader into record
+ * - Nothing is allocated: the moves are unpacked into record->columns
+ * - Returns 1 for a game, 0 at the end of the log and -1 if the rest of the
+ *   log is truncated or isn't made of game records
+ */
+int readGameRecord(GameLogReader *reader, GameRecord *record) {
+    const unsigned char *data = (const unsigned char *) reader->map + reader->offset;
+    const unsigned char *packed = data + sizeof(GameRecordHeader);
+    GameRecordHeader header;
+    size_t size;
+    int bits, mask, offset, value, i;
+
+    if (reader->offset == reader->mapSize) {
+        return 0;
+    }
+    if (reader->mapSize - reader->offset < sizeof(GameRecordHeader)) {
+        return -1;
+    }
+    memcpy(&header, data, sizeof(GameRecordHeader));
+    record->width = header.size >> 4;
+    record->height = header.size & 0xF;
+    record->numMoves = header.numMoves;
+    bits = gameLogMoveBits(record->width);
+    size = sizeof(GameRecordHeader) + (size_t) ((record->numMoves * bits + 7) / 8);
+    if (!isValidGeometry(record->width, record->height) ||
+        record->numMoves > record->width * record->height ||
+        header.engineType >= ENGINE_MAX ||
+        reader->mapSize - reader->offset < size) {
+        return -1;
+    }
+    record->result = (GameResult) (header.flags & 0x3);
+    record->firstPlayer = (header.flags & 0x4) ? PLAYER_HUMAN : PLAYER_AI;
+    record->engineType = (EngineType) header.engineType;
+    record->ordering = header.flags >> 4;
+    record->depth = header.depth;
+    record->moveTime = (int) header.moveTime;
+
+    mask = (1 << bits) - 1;
+    for (i=0; i < record->numMoves; i++) {
+        offset = i * bits;
+        value = packed[offset / 8] >> (offset % 8);
+        if (offset % 8 + bits > 8) {
+            value |= packed[offset / 8 + 1] << (8 - offset % 8);
+        }
+        record->columns[i] = (unsigned char) (value & mask);
+    }
+    reader->offset += size;
+
+    return 1;
+}
+
+/*
+ * Close game log reader
+ * - Used to unmap the game log
+ */
+void closeGameLogReader(GameLogReader *reader) {
+    if (reader->map != NULL) {
+        munmap(reader->map, reader->mapSize);
+    }
+    memset(reader, 0, sizeof(GameLogReader));
+}
+
+/*
+ * Run mode
+ * - Used to select what the program does
+ * - MODE_PLAY is the interactive game against the computer
+ * - MODE_SMP_BENCH reports the speedup of the parallel search
+ * - MODE_ORDER_BENCH reports the tree size with and without each move ordering heuristic
+ * - MODE_BUILD_BOOK builds the opening book file
+ * - MODE_ANALYZE analyzes a stream of positions without interaction
+ * - MODE_SELF_PLAY plays a tournament between two engines without interaction
+ * - MODE_BENCH times the board primitives
+ * - MODE_SERVE hosts games for the clients of a socket
+ * - MODE_REPLAY replays and checks the games of a game log
+ * - MODE_BUILD_INDEX builds the position index of game logs
+ * - MODE_QUERY_INDEX looks positions up in the position index
+ * - MODE_PERFT counts the move sequences of a given depth
+ */
+typedef enum RunMode {
+                         MODE_PLAY,
+                         MODE_SMP_BENCH,
+                         MODE_ORDER_BENCH,
+                         MODE_BUILD_BOOK,
+                         MODE_ANALYZE,
+                         MODE_SELF_PLAY,
+                         MODE_BENCH,
+                         MODE_SERVE,
+                         MODE_REPLAY,
+                         MODE_BUILD_INDEX,
+                         MODE_QUERY_INDEX,
+                         MODE_PERFT,
+                         MODE_MAX
+} RunMode;
+
+/*
+ * Options structure
+ * - Used to hold the command line options
+ * - mode is what the program does
+ * - engine is the configuration of the AI
+ * - outputFile is the file written by MODE_BUILD_BOOK and MODE_BUILD_INDEX
+ * - bookPly is the number of plies covered by MODE_BUILD_BOOK
+ * - inputFile is the file read by MODE_ANALYZE ("-" for stdin) or the game
+ *   log read by MODE_REPLAY
+ * - workers is the number of worker threads of MODE_ANALYZE, MODE_SELF_PLAY,
+ *   MODE_SERVE and MODE_PERFT
+ * - games is the number of games of MODE_SELF_PLAY
+ * - players are the engines playing MODE_SELF_PLAY (players[0] is tested
+ *   against players[1])
+ * - openingPlies is the number of random moves starting each game
+ * - seed is the seed of the random openings
+ * - sprtElo0 and sprtElo1 are the hypotheses of the SPRT (if sprt is set)
+ * - benchJson is the JSON report written by MODE_BENCH (NULL for none)
+ * - benchBaseline is a JSON report MODE_BENCH compares with (NULL for none)
+ * - serveAddress is the socket of MODE_SERVE (see openServerSocket())
+ * - gameLog is the game log the games played are appended to (NULL for none)
+ * - indexLogs are the game logs read by MODE_BUILD_INDEX (separated by commas)
+ * - indexFile is the position index read by MODE_QUERY_INDEX
+ * - perftDepth is the depth counted by MODE_PERFT from the position of the
+ *   move list perftMoves; perftCheck is 1 to cross-check the win checks
+ */
+typedef struct Options {
+    RunMode      mode;
+    EngineConfig engine;
+    const char  *outputFile;
+    int          bookPly;
+    const char  *inputFile;
+    int          workers;
+    long         games;
+    EngineConfig players[2];
+    int          openingPlies;
+    uint64_t     seed;
+    int          sprt;
+    double       sprtElo0;
+    double       sprtElo1;
+    const char  *benchJson;
+    const char  *benchBaseline;
+    const char  *serveAddress;
+    const char  *gameLog;
+    const char  *indexLogs;
+    const char  *indexFile;
+    int          perftDepth;
+    const char  *perftMoves;
+    int          perftCheck;
+} Options;
+
+/*
+ * Bench positions
+ * - Fixed set of positions (as move lists) used by the benchmarks
+ * - Covers the opening, where the search is the slowest, and the middle game
+ * - None of them is won yet, so the next move can be searched from all of them
+ */
+const char *benchPositions[] = {
+    "",
+    "D",
+    "DC",
+    "DDCE",
+    "DCDDDCE",
+    "DDDDDDCCE",
+    "CDEDEDCC",
+    "DDCCEEBF",
+    "FAAFCBBBFA",
+    "FFEAEDAAABBE",
+    "FDBEBFEEDBGDGD",
+    "BAAFDCDDDGFAFFFA",
+    "BDCCGAGCCFEDFGECAA",
+    "EDBGGDACFDFGDDFGGFBD",
+    "ACBACAGFFCGBBACGDFGBGFDD",
+    NULL
+};
+
+/*
+ * Run smp bench
+ * - Used to report the speedup of the parallel search
+ * - Every bench position is searched to the configured depth with 1, 2, 4...
+ *   threads up to --threads (or the number of cores), from an empty table
+ * - The speedup is the time with 1 thread over the time with N threads
+ */
+int runSmpBench(const Options *options) {
+    EngineConfig config = options->engine;
+    TransTable table;
+    Position pos;
+    SearchResult result;
+    long long start, timeUs, baseTimeUs = 0;
+    long nodes;
+    int maxThreads = config.threads;
+    int threads, i;
+
+    if (maxThreads <= 1) {
+        maxThreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (maxThreads > MAX_SEARCH_THREADS) {
+        maxThreads = MAX_SEARCH_THREADS;
+    }
+    if (!createTable(&table, config.hashMB)) {
+        printf("Failed to create transposition table\n");
+        return -1;
+    }
+    config.moveTime = 0;
+
+    printf("Lazy SMP speedup at depth %d\n", config.depth);
+    printf("%8s %12s %14s %10s %8s\n", "threads", "time(ms)", "nodes", "knps", "speedup");
+    threads = 1;
+    while (threads <= maxThreads) {
+        config.threads = threads;
+        timeUs = 0;
+        nodes = 0;
+        for (i=0; benchPositions[i] != NULL; i++) {
+            initPosition(&pos, config.width, config.height);
+            positionPlayMoves(&pos, benchPositions[i]);
+            clearTable(&table);
+            start = getTimeUs();
+            searchPosition(&pos, &config, &table, NULL, &result);
+            timeUs += getTimeUs() - start;
+            nodes += result.nodes;
+        }
+        if (threads == 1) {
+            baseTimeUs = timeUs;
+        }
+        printf("%8d %12.1f %14ld %10.1f %8.2f\n", threads, timeUs / 1000.0, nodes,
+               (timeUs > 0) ? (1000.0 * nodes / timeUs) : 0.0,
+               (timeUs > 0) ? ((double) baseTimeUs / timeUs) : 0.0);
+
+        if (threads < maxThreads && threads * 2 > maxThreads) {
+            threads = maxThreads;
+        }
+        else {
+            threads *= 2;
+        }
+    }
+
+    deleteTable(&table);
+    return 0;
+}
+
+/*
+ * Format ordering
+ * - Used to write the names of the heuristics of ordering to text, e.g.
+ *   "center+tt", "all" or "none"
+ */
+void formatOrdering(int ordering, char *text) {
+    int i;
+
+    text[0] = '\0';
+    if (ordering == ORDER_ALL) {
+        strcpy(text, "all");
+    }
+    else if (ordering == 0) {
+        strcpy(text, "none");
+    }
+    for (i=0; i < 4 && ordering != ORDER_ALL; i++) {
+        if (ordering & (1 << i)) {
+            if (text[0] != '\0') {
+                strcat(text, "+");
+            }
+            strcat(text, orderNames[i]);
+        }
+    }
+}
+
+/*
+ * Run order bench
+ * - Used to search benchPositions with every move ordering heuristic on its
+ *   own, all of them but one, all and none
+ * - Reports the number of nodes and the time spent, with the ratio of nodes
+ *   to the search with the default heuristics (ORDER_DEFAULT)
+ * - Every search is single threaded and starts from an empty table, so the
+ *   node counts are repeatable
+ */
+int runOrderBench(const Options *options) {
+    EngineConfig config = options->engine;
+    TransTable table;
+    Position pos;
+    SearchResult result;
+    char name[64];
+    int orderings[11];
+    long long start, timeUs;
+    long nodes, defaultNodes = 0;
+    int numOrderings = 0;
+    int i, j;
+
+    if (!createTable(&table, config.hashMB)) {
+        printf("Failed to create transposition table\n");
+        return -1;
+    }
+    config.moveTime = 0;
+    config.threads = 1;
+
+    orderings[numOrderings++] = ORDER_DEFAULT;
+    orderings[numOrderings++] = ORDER_ALL;
+    for (i=0; i < 4; i++) {
+        orderings[numOrderings++] = ORDER_ALL & ~(1 << i);
+    }
+    for (i=0; i < 4; i++) {
+        orderings[numOrderings++] = 1 << i;
+    }
+    orderings[numOrderings++] = 0;
+
+    printf("Move ordering at depth %d\n", config.depth);
+    printf("%-24s %14s %12s %10s\n", "ordering", "nodes", "time(ms)", "vs default");
+    for (j=0; j < numOrderings; j++) {
+        config.ordering = orderings[j];
+        timeUs = 0;
+        nodes = 0;
+        for (i=0; benchPositions[i] != NULL; i++) {
+            initPosition(&pos, config.width, config.height);
+            positionPlayMoves(&pos, benchPositions[i]);
+            clearTable(&table);
+            start = getTimeUs();
+            searchPosition(&pos, &config, &table, NULL, &result);
+            timeUs += getTimeUs() - start;
+            nodes += result.nodes;
+        }
+        if (j == 0) {
+            defaultNodes = nodes;
+        }
+        formatOrdering(orderings[j], name);
+        if (j >= 2 && j <= 5) {
+            strcpy(name, "all but ");
+            strcat(name, orderNames[j - 2]);
+        }
+        printf("%-24s %14ld %12.1f %9.2fx\n", name, nodes, timeUs / 1000.0,
+               (defaultNodes > 0) ? ((double) nodes / defaultNodes) : 0.0);
+    }
+
+    deleteTable(&table);
+    return 0;
+}
+
+/*
+ * Compare position keys
+ * - qsort() callback ordering positions by key
+ */
+int comparePositionKeys(const void *a, const void *b) {
+    uint64_t keyA = positionKey((const Position *) a);
+    uint64_t keyB = positionKey((const Position *) b);
+
+    return (keyA < keyB) ? -1 : ((keyA > keyB) ? 1 : 0);
+}
+
+/*
+ * Compare book records
+ * - qsort() callback ordering (key, entry) pairs by key
+ */
+int compareBookRecords(const void *a, const void *b) {
+    uint64_t keyA = *((const uint64_t *) a);
+    uint64_t keyB = *((const uint64_t *) b);
+
+    return (keyA < keyB) ? -1 : ((keyA > keyB) ? 1 : 0);
+}
+
+/*
+ * Run build book
+ * - Used to build the opening book file options->outputFile
+ * - Every position reachable in less than options->bookPly plies is
+ *   generated one ply at a time, with duplicated positions (same canonical
+ *   key, so mirrors too) removed
+ * - Positions where the game is already won are left out
+ * - Every position is searched with the engine configuration of options and
+ *   the book is written sorted by key
+ */
+int runBuildBook(const Options *options) {
+    EngineConfig config = options->engine;
+    TransTable table;
+    SearchResult result;
+    Position *level = NULL, *next = NULL;
+    uint64_t *records = NULL, *grown;
+    uint32_t entry;
+    long levelCount = 0, nextCount, numRecords = 0, i, j;
+    BookHeader header;
+    FILE *file = NULL;
+    int ply, column, player;
+    int rc = -1;
+
+    config.bookFile = NULL;
+    if (!createTable(&table, config.hashMB)) {
+        printf("Failed to create transposition table\n");
+        return rc;
+    }
+
+    level = (Position *) malloc(sizeof(Position));
+    initPosition(level, config.width, config.height);
+    levelCount = 1;
+
+    for (ply=0; level != NULL && ply < options->bookPly && levelCount > 0; ply++) {
+        grown = (uint64_t *) realloc(records, (numRecords + levelCount) * 2 * sizeof(uint64_t));
+        if (grown == NULL) {
+            break;
+        }
+        records = grown;
+        next = (Position *) malloc(levelCount * config.width * sizeof(Position));
+        if (next == NULL) {
+            break;
+        }
+
+        nextCount = 0;
+        for (i=0; i < levelCount; i++) {
+            searchPosition(&level[i], &config, &table, NULL, &result);
+            records[2 * numRecords] = positionKey(&level[i]);
+            records[2 * numRecords + 1] = bookPackEntry(canonicalColumn(&level[i], result.column),
+                                                        result.depth, result.score);
+            numRecords++;
+
+            player = level[i].numFilled & 1;
+            for (column=0; column < level[i].width; column++) {
+                if (positionCanPlay(&level[i], column) &&
+                    !positionIsWinningMove(&level[i], column, player)) {
+                    next[nextCount] = level[i];
+                    positionDropDisc(&next[nextCount], column, player);
+                    nextCount++;
+                }
+            }
+        }
+        fprintf(stderr, "Book ply %d: %ld positions\n", ply, levelCount);
+
+        qsort(next, nextCount, sizeof(Position), comparePositionKeys);
+        for (i=0, j=0; i < nextCount; i++) {
+            if (j == 0 || positionKey(&next[i]) != positionKey(&next[j - 1])) {
+                next[j++] = next[i];
+            }
+        }
+        free(level);
+        level = next;
+        levelCount = j;
+        next = NULL;
+    }
+
+    if (ply == options->bookPly || levelCount == 0) {
+        qsort(records, numRecords, 2 * sizeof(uint64_t), compareBookRecords);
+        memset(&header, 0, sizeof(BookHeader));
+        memcpy(header.magic, BOOK_MAGIC, sizeof(BOOK_MAGIC));
+        header.version = BOOK_VERSION;
+        header.width = config.width;
+        header.height = config.height;
+        header.ply = (unsigned char) options->bookPly;
+        header.zobristCheck = zobristCheck();
+        header.count = (uint64_t) numRecords;
+
+        file = fopen(options->outputFile, "wb");
+        if (file != NULL) {
+            fwrite(&header, sizeof(BookHeader), 1, file);
+            for (i=0; i < numRecords; i++) {
+                fwrite(&records[2 * i], sizeof(uint64_t), 1, file);
+            }
+            for (i=0; i < numRecords; i++) {
+                entry = (uint32_t) records[2 * i + 1];
+                fwrite(&entry, sizeof(uint32_t), 1, file);
+            }
+            if (fclose(file) == 0) {
+                printf("Wrote %ld positions to %s\n", numRecords, options->outputFile);
+                rc = 0;
+            }
+        }
+        if (rc != 0) {
+            printf("Failed to write %s\n", options->outputFile);
+        }
+    }
+    else {
+        printf("Out of memory while building the book\n");
+    }
+
+    free(level);
+    free(next);
+    free(records);
+    deleteTable(&table);
+    return rc;
+}
+
+/*
+ * Position index file format
+ * - All the numbers are stored in the byte order of the machine
+ * - IndexHeader, then count position keys (uint64_t, sorted ascending), then
+ *   count IndexEntry in the same order as the keys
+ * - The keys are canonical (see positionKey()) and the moves of an entry are
+ *   the columns of the canonical position
+ * - games and logs are the number of games and game logs indexed
+ * - zobristCheck is a digest of zobristKeys, as in the book files
+ */
+#define INDEX_MAGIC    "CF4INDX"
+#define INDEX_VERSION  2
+
+/* Column of an index record made on the last position of a game */
+#define INDEX_NO_MOVE  0xF
+
+typedef struct IndexHeader {
+    char          magic[8];
+    uint32_t      version;
+    unsigned char width;
+    unsigned char height;
+    unsigned char reserved[2];
+    uint64_t      zobristCheck;
+    uint64_t      games;
+    uint64_t      count;
+} IndexHeader;
+
+/*
+ * Index entry structure
+ * - Statistics of one position of the position index
+ * - games is the number of games that went through the position, results
+ *   how many of them 'X' won, 'O' won and were tied (the others weren't
+ *   finished), and moves how many times each column was played next
+ */
+typedef struct IndexEntry {
+    uint32_t games;
+    uint32_t results[3];
+    uint32_t moves[MAX_BOARD_WIDTH];
+} IndexEntry;
+
+/*
+ * Position index structure
+ * - Used to look positions up in a memory mapped index file
+ * - map and mapSize are the mapped file (map is NULL if no index is open)
+ * - keys and entries point into the mapped file
+ * - count is the number of positions and games the number of games indexed
+ */
+typedef struct PositionIndex {
+    void             *map;
+    size_t            mapSize;
+    const uint64_t   *keys;
+    const IndexEntry *entries;
+    uint64_t          count;
+    uint64_t          games;
+} PositionIndex;
+
+/*
+ * Open position index
+ * - Used to map the index file at path into memory
+ * - The file is checked against the board size and the Zobrist keys
+ * - Nothing is read up front: a lookup only touches the pages of its binary
+ *   search and of its entry
+ * - Returns 0 if the file cannot be mapped or is not a valid index
+ */
+int openPositionIndex(PositionIndex *index, const char *path, int width, int height) {
+    IndexHeader header;
+    struct stat st;
+    int fd;
+    int success = 0;
+
+    memset(index, 0, sizeof(PositionIndex));
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    if (fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(IndexHeader)) {
+        index->map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (index->map == MAP_FAILED) {
+            index->map = NULL;
+        }
+        else {
+            index->mapSize = (size_t) st.st_size;
+            madvise(index->map, index->mapSize, MADV_RANDOM);
+            memcpy(&header, index->map, sizeof(IndexHeader));
+            if (memcmp(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) == 0 &&
+                header.version == INDEX_VERSION &&
+                header.width == width && header.height == height &&
+                header.zobristCheck == zobristCheck() &&
+                index->mapSize == sizeof(IndexHeader) + header.count * (sizeof(uint64_t) + sizeof(IndexEntry))) {
+                index->count = header.count;
+                index->games = header.games;
+                index->keys = (const uint64_t *) ((const char *) index->map + sizeof(IndexHeader));
+                index->entries = (const IndexEntry *) (index->keys + index->count);
+                success = 1;
+            }
+        }
+    }
+    close(fd);
+
+    if (!success && index->map != NULL) {
+        munmap(index->map, index->mapSize);
+        memset(index, 0, sizeof(PositionIndex));
+    }
+
+    return success;
+}
+
+/*
+ * Close position index
+ * - Used to unmap the index file
+ */
+void closePositionIndex(PositionIndex *index) {
+    if (index->map != NULL) {
+        munmap(index->map, index->mapSize);
+    }
+    memset(index, 0, sizeof(PositionIndex));
+}
+
+/*
+ * Probe position index
+ * - Used to look up key in the index with a binary search
+ * - Returns the entry of the position, or NULL if no game went through it
+ */
+const IndexEntry *probePositionIndex(const PositionIndex *index, uint64_t key) {
+    uint64_t low = 0;
+    uint64_t high = index->count;
+    uint64_t middle;
+
+    while (low < high) {
+        middle = low + (high - low) / 2;
+        if (index->keys[middle] < key) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+    if (low < index->count && index->keys[low] == key) {
+        return &index->entries[low];
+    }
+
+    return NULL;
+}
+
+/*
+ * Add index record
+ * - Used to add one occurrence of a position to entry
+ * - record packs the result of the game (bits 0-1, see GameResult) and the
+ *   column played next (bits 2-5, INDEX_NO_MOVE for none)
+ */
+void addIndexRecord(IndexEntry *entry, uint64_t record) {
+    int result = (int) (record & 0x3);
+    int column = (int) ((record >> 2) & 0xF);
+
+    entry->games++;
+    if (result != RESULT_NONE) {
+        entry->results[result - RESULT_X_WINS]++;
+    }
+    if (column != INDEX_NO_MOVE) {
+        entry->moves[column]++;
+    }
+}
+
+/*
+ * Run build index
+ * - Used to build the position index options->outputFile from the game logs
+ *   options->indexLogs (separated by commas)
+ * - Every position of every game of the board size, from the empty board to
+ *   the last move, is recorded as its canonical key, so the positions reached
+ *   by different move orders and their mirrors are the same position
+ * - A game playing a column that is out of the board or full is invalid and
+ *   none of its positions are recorded
+ * - The records are sorted by key and merged into one entry per position
+ */
+int runBuildIndex(const Options *options) {
+    GameLogReader reader;
+    GameRecord record;
+    Position pos;
+    IndexHeader header;
+    IndexEntry entry;
+    uint64_t *records = NULL, *grown;
+    char *paths = NULL, *path, *save = NULL;
+    long capacity = 0, numRecords = 0, numKeys = 0, games = 0, skipped = 0, invalid = 0, first, i, j;
+    FILE *file = NULL;
+    int numLogs = 0;
+    int status = 1;
+    int rc = -1;
+    int k;
+
+    paths = strdup(options->indexLogs);
+    for (path=strtok_r(paths, ",", &save); status >= 0 && path != NULL; path=strtok_r(NULL, ",", &save)) {
+        if (!openGameLogReader(&reader, path)) {
+            printf("Failed to open game log %s\n", path);
+            status = -1;
+            break;
+        }
+        numLogs++;
+        while ((status = readGameRecord(&reader, &record)) > 0) {
+            if (record.width != options->engine.width || record.height != options->engine.height) {
+                skipped++;
+                continue;
+            }
+            if (numRecords + record.numMoves + 1 > capacity) {
+                capacity = (capacity > 0) ? 2 * capacity : 1 << 20;
+                grown = (uint64_t *) realloc(records, capacity * 2 * sizeof(uint64_t));
+                if (grown == NULL) {
+                    printf("Out of memory while building the index\n");
+                    status = -2;
+                    break;
+                }
+                records = grown;
+            }
+            initPosition(&pos, record.width, record.height);
+            first = numRecords;
+            for (k=0; k <= record.numMoves; k++) {
+                if (k < record.numMoves && !positionCanPlay(&pos, record.columns[k])) {
+                    break;
+                }
+                records[2 * numRecords] = positionKey(&pos);
+                records[2 * numRecords + 1] = (uint64_t) (record.result |
+                                              (((k < record.numMoves) ? canonicalColumn(&pos, record.columns[k]) :
+                                                INDEX_NO_MOVE) << 2));
+                numRecords++;
+                if (k < record.numMoves) {
+                    positionDropDisc(&pos, record.columns[k], k & 1);
+                }
+            }
+            if (k <= record.numMoves) {
+                numRecords = first;
+                invalid++;
+                continue;
+            }
+            games++;
+        }
+        closeGameLogReader(&reader);
+        if (status == -1) {
+            printf("Game log %s is corrupt\n", path);
+        }
+    }
+    free(paths);
+
+    if (status >= 0) {
+        qsort(records, numRecords, 2 * sizeof(uint64_t), compareBookRecords);
+        for (i=0; i < numRecords; i++) {
+            if (i == 0 || records[2 * i] != records[2 * (i - 1)]) {
+                numKeys++;
+            }
+        }
+        memset(&header, 0, sizeof(IndexHeader));
+        memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+        header.version = INDEX_VERSION;
+        header.width = (unsigned char) options->engine.width;
+        header.height = (unsigned char) options->engine.height;
+        header.zobristCheck = zobristCheck();
+        header.games = (uint64_t) games;
+        header.count = (uint64_t) numKeys;
+
+        file = fopen(options->outputFile, "wb");
+        if (file != NULL) {
+            fwrite(&header, sizeof(IndexHeader), 1, file);
+            for (i=0; i < numRecords; i++) {
+                if (i == 0 || records[2 * i] != records[2 * (i - 1)]) {
+                    fwrite(&records[2 * i], sizeof(uint64_t), 1, file);
+                }
+            }
+            for (i=0; i < numRecords; i=j) {
+                memset(&entry, 0, sizeof(IndexEntry));
+                for (j=i; j < numRecords && records[2 * j] == records[2 * i]; j++) {
+                    addIndexRecord(&entry, records[2 * j + 1]);
+                }
+                fwrite(&entry, sizeof(IndexEntry), 1, file);
+            }
+            if (fclose(file) == 0) {
+                printf("Indexed %ld positions of %ld games from %d logs (%ld games of another size and %ld invalid "
+                       "games skipped) to %s\n", numKeys, games, numLogs, skipped, invalid, options->outputFile);
+                rc = 0;
+            }
+        }
+        if (rc != 0) {
+            printf("Failed to write %s\n", options->outputFile);
+        }
+    }
+
+    free(records);
+    return rc;
+}
+
+/*
+ * Run query index
+ * - Used to look up the positions read from stdin (one move list per line)
+ *   in the position index options->indexFile
+ * - Each output line is "moves games x_wins o_wins ties" followed by the
+ *   columns played next as C:count, translated back from the canonical
+ *   position; a position of no game has 0 games
+ * - The number of lookups and their mean time are written to stderr
+ */
+int runQueryIndex(const Options *options) {
+    PositionIndex index;
+    const IndexEntry *entry;
+    Position pos;
+    char *line = NULL;
+    char moves[MAX_ENTRIES + 1];
+    size_t capacity = 0;
+    long long start, lookupNs = 0;
+    long lookups = 0;
+    int numMoves, column;
+    const char *move;
+
+    if (!openPositionIndex(&index, options->indexFile, options->engine.width, options->engine.height)) {
+        printf("Failed to open position index %s\n", options->indexFile);
+        return -1;
+    }
+
+    while (getline(&line, &capacity, stdin) >= 0) {
+        numMoves = 0;
+        for (move=line; *move != '\0' && numMoves < MAX_ENTRIES; move++) {
+            if (*move >= 'A' && *move <= 'Z') {
+                moves[numMoves++] = *move;
+            }
+        }
+        if (numMoves == 0) {
+            moves[numMoves++] = '-';
+        }
+        moves[numMoves] = '\0';
+
+        initPosition(&pos, options->engine.width, options->engine.height);
+        if (!positionPlayMoves(&pos, line)) {
+            printf("%s error\n", moves);
+            continue;
+        }
+        start = getTimeNs();
+        entry = probePositionIndex(&index, positionKey(&pos));
+        lookupNs += getTimeNs() - start;
+        lookups++;
+        if (entry == NULL) {
+            printf("%s 0 0 0 0\n", moves);
+            continue;
+        }
+        printf("%s %u %u %u %u", moves, entry->games, entry->results[0], entry->results[1], entry->results[2]);
+        for (column=0; column < pos.width; column++) {
+            if (entry->moves[canonicalColumn(&pos, column)] > 0) {
+                printf(" %c:%u", 'A' + column, entry->moves[canonicalColumn(&pos, column)]);
+            }
+        }
+        printf("\n");
+    }
+
+    fprintf(stderr, "%ld lookups in %llu positions of %llu games, %.0f ns per lookup\n",
+            lookups, (unsigned long long) index.count, (unsigned long long) index.games, (lookups > 0) ? ((double) lookupNs / lookups) : 0.0);
+    free(line);
+    closePositionIndex(&index);
+
+    return 0;
+}
+
+/*
+ * Perft check structure
+ * - Used to count the moves cross-checked by perftGameMove() and the ones
+ *   where the representations disagree
+ * - firstMismatch is the move list of the first disagreement
+ */
+typedef struct PerftCheck {
+    long long moves;
+    long long mismatches;
+    char      firstMismatch[MAX_MOVES + 1];
+} PerftCheck;
+
+/*
+ * Perft structure
+ * - Used to share the root columns of MODE_PERFT between the workers
+ * - root is the position counted from, moves its move list and depth the
+ *   number of plies counted
+ * - check is 1 to count on a Game with perftGameMove() instead of the Position
+ * - next is the next root column to count (taken atomically) and nodes the
+ *   count of each root column
+ * - checked merges the PerftCheck of the workers under lock
+ */
+typedef struct Perft {
+    Position        root;
+    const char     *moves;
+    int             depth;
+    int             check;
+    int             next;
+    long long       nodes[MAX_BOARD_WIDTH];
+    PerftCheck      checked;
+    pthread_mutex_t lock;
+} Perft;
+
+/*
+ * Perft move
+ * - Used to count the move sequences of depth plies from pos starting with
+ *   column; a sequence stops at a win or a full board, so it's counted only
+ *   if the win comes on its last ply
+ * - The moves are made and undone in place; the last ply is counted without
+ *   being made
+ */
+long long perftMove(Position *pos, int column, int depth) {
+    long long nodes = 0;
+    int player = pos->numFilled & 1;
+    int i;
+
+    if (!positionCanPlay(pos, column)) {
+        return 0;
+    }
+    if (depth == 1) {
+        return 1;
+    }
+    if (positionIsWinningMove(pos, column, player)) {
+        return 0;
+    }
+    positionDropDisc(pos, column, player);
+    for (i=0; i < pos->width; i++) {
+        nodes += perftMove(pos, i, depth - 1);
+    }
+    positionUndoDisc(pos, column);
+
+    return nodes;
+}
+
+/*
+ * Perft game move
+ * - Same count as perftMove() on a Game, with every move made with
+ *   makeMove() and taken back with unmakeMove(), the last ply included
+ * - Each move is cross-checked: the grid cell it lands on must be empty,
+ *   and the win found on the bitboard (positionIsWinningMove()), on the
+ *   line counts (lineCountsScore(), as dropDisc() does) and by following the
+ *   grids (isWin()) must agree; disagreements are counted in check
+ */
+long long perftGameMove(Game *game, int column, int depth, PerftCheck *check) {
+    Board *board = game->board;
+    long long nodes = 1;
+    int player = game->position.numFilled & 1;
+    char data = (player == 0) ? 'X' : 'O';
+    int row, bitboardWin, countsWin, gridWin, empty, score, i;
+
+    if (!positionCanPlay(&game->position, column)) {
+        return 0;
+    }
+    empty = (getGrid(board, column, board->height - 1 - game->position.heights[column])->data == '.');
+    bitboardWin = positionIsWinningMove(&game->position, column, player);
+    row = makeMove(game, column, data);
+    countsWin = (lineCountsScore(game->lines, &game->lineCounts,
+                                 column * game->position.stride + row, player) >= 4);
+    gridWin = isWin(board, column, board->height - 1 - row, data, &score);
+    check->moves++;
+    if (!empty || countsWin != bitboardWin || gridWin != bitboardWin) {
+        if (check->mismatches++ == 0) {
+            for (i=0; i < game->numMoves; i++) {
+                check->firstMismatch[i] = game->history[i].data;
+            }
+            check->firstMismatch[i] = '\0';
+        }
+    }
+
+    if (depth > 1) {
+        nodes = 0;
+        if (!bitboardWin) {
+            for (i=0; i < board->width; i++) {
+                nodes += perftGameMove(game, i, depth - 1, check);
+            }
+        }
+    }
+    unmakeMove(game);
+
+    return nodes;
+}
+
+/*
+ * Perft worker main
+ * - Entry point of the workers of MODE_PERFT
+ * - Takes root columns until there are none left and counts each of them
+ *   on its own copy of the root (a Game replaying the moves with check)
+ */
+void *perftWorkerMain(void *arg) {
+    Perft *perft = (Perft *) arg;
+    Position pos = perft->root;
+    PerftCheck check;
+    Game *game = NULL;
+    int column;
+
+    memset(&check, 0, sizeof(PerftCheck));
+    if (perft->check) {
+        game = createGame(PLAYER_AI, pos.width, pos.height);
+        if (game == NULL || !playMoves(game, perft->moves)) {
+            deleteGame(game);
+            return NULL;
+        }
+    }
+    while ((column = __atomic_fetch_add(&perft->next, 1, __ATOMIC_RELAXED)) < pos.width) {
+        perft->nodes[column] = (game != NULL) ? perftGameMove(game, column, perft->depth, &check) :
+                               perftMove(&pos, column, perft->depth);
+    }
+    deleteGame(game);
+
+    pthread_mutex_lock(&perft->lock);
+    if (check.mismatches > 0 && perft->checked.mismatches == 0) {
+        strcpy(perft->checked.firstMismatch, check.firstMismatch);
+    }
+    perft->checked.moves += check.moves;
+    perft->checked.mismatches += check.mismatches;
+    pthread_mutex_unlock(&perft->lock);
+
+    return NULL;
+}
+
+/*
+ * Run perft
+ * - Used to count the move sequences of options->perftDepth plies from the
+ *   position of options->perftMoves (see perftMove()), a correctness check
+ *   of the board core and a measure of its speed
+ * - The root columns are spread over options->workers threads
+ * - Prints the count of each playable root column, then the total, the time
+ *   and the nodes per second
+ * - With options->perftCheck the count is made on a Game and every move is
+ *   cross-checked (see perftGameMove()); returns 1 if any check failed
+ */
+int runPerft(const Options *options) {
+    Perft perft;
+    pthread_t threads[MAX_BOARD_WIDTH];
+    long long start, timeUs, total = 0;
+    int numWorkers = options->workers;
+    int started = 0;
+    int i;
+
+    memset(&perft, 0, sizeof(Perft));
+    initPosition(&perft.root, options->engine.width, options->engine.height);
+    if (!positionPlayMoves(&perft.root, options->perftMoves)) {
+        printf("Invalid moves %s\n", options->perftMoves);
+        return -1;
+    }
+    perft.moves = options->perftMoves;
+    perft.depth = options->perftDepth;
+    perft.check = options->perftCheck;
+    if (positionHasFour(&perft.root, perft.root.discs[(perft.root.numFilled & 1) ^ 1])) {
+        perft.next = perft.root.width;
+    }
+    pthread_mutex_init(&perft.lock, NULL);
+
+    if (numWorkers < 1) {
+        numWorkers = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (numWorkers > perft.root.width) {
+        numWorkers = perft.root.width;
+    }
+
+    start = getTimeUs();
+    for (started=0; started < numWorkers; started++) {
+        if (pthread_create(&threads[started], NULL, perftWorkerMain, &perft) != 0) {
+            break;
+        }
+    }
+    if (started == 0) {
+        perftWorkerMain(&perft);
+    }
+    for (i=0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    timeUs = getTimeUs() - start;
+    pthread_mutex_destroy(&perft.lock);
+
+    for (i=0; i < perft.root.width; i++) {
+        if (positionCanPlay(&perft.root, i)) {
+            printf("%c %lld\n", 'A' + i, perft.nodes[i]);
+        }
+        total += perft.nodes[i];
+    }
+    printf("Depth %d: %lld nodes in %.3f s (%.0f nodes/s) with %d workers\n",
+           perft.depth, total, timeUs / 1000000.0,
+           (timeUs > 0) ? (total * 1000000.0 / timeUs) : 0.0, (started > 0) ? started : 1);
+    if (perft.check) {
+        printf("Checked %lld moves: %lld mismatches", perft.checked.moves, perft.checked.mismatches);
+        if (perft.checked.mismatches > 0) {
+            printf(", first after %s", perft.checked.firstMismatch);
+        }
+        printf("\n");
+        if (perft.checked.mismatches > 0 || perft.checked.moves == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* Number of input lines analyzed together by MODE_ANALYZE */
+#define BATCH_LINES        4096
+
+/* Size of the output of one analyzed line */
+#define BATCH_OUTPUT_SIZE  192
+
+/*
+ * Batch structure
+ * - Used to share one chunk of input lines between the analysis workers
+ * - lines and count are the chunk; outputs has BATCH_OUTPUT_SIZE bytes per line
+ *   and outputLengths the length of each output
+ * - next is the index of the next line to analyze (taken atomically)
+ * - generation is increased for every new chunk and pending counts the
+ *   workers still busy on the current one
+ * - quit tells the workers to exit
+ */
+typedef struct Batch {
+    char          **lines;
+    int             count;
+    char           *outputs;
+    int            *outputLengths;
+    int             next;
+    int             generation;
+    int             pending;
+    int             quit;
+    pthread_mutex_t lock;
+    pthread_cond_t  ready;
+    pthread_cond_t  done;
+} Batch;
+
+/*
+ * Batch worker structure
+ * - Used to hold one analysis worker thread and its private engine
+ */
+typedef struct BatchWorker {
+    pthread_t thread;
+    Batch    *batch;
+    Engine   *engine;
+} BatchWorker;
+
+/*
+ * Analyze line
+ * - Used to analyze the position given by the moves of line
+ * - The output is "moves best score depth nodes time_us source" where moves
+ *   is the list of columns played ("-" for the empty board), best the best
+ *   column and source where it comes from (see searchSource())
+ * - A position that can't be played or that is already over gets "error"
+ *   or "over" instead of the best column and the statistics
+ */
+int analyzeLine(Engine *engine, const char *line, char *output) {
+    Position pos;
+    SearchResult result;
+    char moves[MAX_ENTRIES + 1];
+    int numMoves = 0;
+    const char *move;
+
+    for (move=line; *move != '\0' && numMoves < MAX_ENTRIES; move++) {
+        if (*move >= 'A' && *move <= 'Z') {
+            moves[numMoves++] = *move;
+        }
+    }
+    moves[numMoves] = '\0';
+    if (numMoves == 0) {
+        moves[numMoves++] = '-';
+        moves[numMoves] = '\0';
+    }
+
+    initPosition(&pos, engine->config.width, engine->config.height);
+    if (!positionPlayMoves(&pos, line)) {
+        return snprintf(output, BATCH_OUTPUT_SIZE, "%s error\n", moves);
+    }
+    if (positionIsGameOver(&pos) ||
+        positionHasFour(&pos, pos.discs[(pos.numFilled & 1) ^ 1])) {
+        return snprintf(output, BATCH_OUTPUT_SIZE, "%s over\n", moves);
+    }
+
+    engineNextMove(engine, &pos, &result);
+    reportSearch(&pos, &result);
+    return snprintf(output, BATCH_OUTPUT_SIZE, "%s %c %d %d %ld %lld %s\n", moves,
+                    (char) (result.column + 'A'), result.score, result.depth,
+                    result.nodes, result.timeUs, searchSource(&result));
+}
+
+/*
+ * Batch worker main
+ * - Entry point of the analysis worker threads
+ * - Waits for a new chunk, analyzes lines until there are none left, then
+ *   reports it's done and waits for the next chunk
+ */
+void *batchWorkerMain(void *arg) {
+    BatchWorker *worker = (BatchWorker *) arg;
+    Batch *batch = worker->batch;
+    int generation = 0;
+    int index;
+
+    pthread_mutex_lock(&batch->lock);
+    for (;;) {
+        while (!batch->quit && batch->generation == generation) {
+            pthread_cond_wait(&batch->ready, &batch->lock);
+        }
+        if (batch->quit) {
+            break;
+        }
+        generation = batch->generation;
+        pthread_mutex_unlock(&batch->lock);
+
+        index = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED);
+        while (index < batch->count) {
+            batch->outputLengths[index] = analyzeLine(worker->engine, batch->lines[index],
+                                                      batch->outputs + index * BATCH_OUTPUT_SIZE);
+            index = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED);
+        }
+
+        pthread_mutex_lock(&batch->lock);
+        batch->pending--;
+        if (batch->pending == 0) {
+            pthread_cond_signal(&batch->done);
+        }
+    }
+    pthread_mutex_unlock(&batch->lock);
+
+    return NULL;
+}
+
+/*
+ * Run analyze
+ * - Used to analyze one position per line of options->inputFile
+ * - Lines are read BATCH_LINES at a time and spread over options->workers
+ *   threads, each with its own engine (searching with a single thread)
+ * - The outputs of a chunk are written in input order with a single fwrite()
+ */
+int runAnalyze(const Options *options) {
+    EngineConfig config = options->engine;
+    Batch batch;
+    BatchWorker *workers = NULL;
+    FILE *input = stdin;
+    char *chunk = NULL;
+    size_t *capacities = NULL;
+    size_t length;
+    ssize_t read = 0;
+    long total = 0;
+    int numWorkers = options->workers;
+    int started = 0;
+    int rc = -1;
+    int i;
+
+    if (strcmp(options->inputFile, "-") != 0) {
+        input = fopen(options->inputFile, "r");
+        if (input == NULL) {
+            printf("Cannot open %s\n", options->inputFile);
+            return rc;
+        }
+    }
+    if (numWorkers < 1) {
+        numWorkers = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    config.threads = 1;
+
+    memset(&batch, 0, sizeof(Batch));
+    pthread_mutex_init(&batch.lock, NULL);
+    pthread_cond_init(&batch.ready, NULL);
+    pthread_cond_init(&batch.done, NULL);
+    batch.lines = (char **) calloc(BATCH_LINES, sizeof(char *));
+    batch.outputs = (char *) malloc(BATCH_LINES * BATCH_OUTPUT_SIZE);
+    batch.outputLengths = (int *) calloc(BATCH_LINES, sizeof(int));
+    capacities = (size_t *) calloc(BATCH_LINES, sizeof(size_t));
+    chunk = (char *) malloc(BATCH_LINES * BATCH_OUTPUT_SIZE);
+    workers = (BatchWorker *) calloc(numWorkers, sizeof(BatchWorker));
+
+    if (batch.lines != NULL && batch.outputs != NULL && batch.outputLengths != NULL &&
+        capacities != NULL && chunk != NULL && workers != NULL) {
+        for (started=0; started < numWorkers; started++) {
+            workers[started].batch = &batch;
+            workers[started].engine = createEngine(&config);
+            if (workers[started].engine == NULL ||
+                pthread_create(&workers[started].thread, NULL, batchWorkerMain, &workers[started]) != 0) {
+                deleteEngine(workers[started].engine);
+                break;
+            }
+        }
+    }
+
+    if (started > 0) {
+        rc = 0;
+        while (read >= 0) {
+            batch.count = 0;
+            while (batch.count < BATCH_LINES &&
+                   (read = getline(&batch.lines[batch.count], &capacities[batch.count], input)) >= 0) {
+                batch.count++;
+            }
+            if (batch.count == 0) {
+                break;
+            }
+
+            pthread_mutex_lock(&batch.lock);
+            batch.next = 0;
+            batch.pending = started;
+            batch.generation++;
+            pthread_cond_broadcast(&batch.ready);
+            while (batch.pending > 0) {
+                pthread_cond_wait(&batch.done, &batch.lock);
+            }
+            pthread_mutex_unlock(&batch.lock);
+
+            length = 0;
+            for (i=0; i < batch.count; i++) {
+                memcpy(chunk + length, batch.outputs + i * BATCH_OUTPUT_SIZE, batch.outputLengths[i]);
+                length += batch.outputLengths[i];
+            }
+            if (fwrite(chunk, 1, length, stdout) != length) {
+                rc = -1;
+                break;
+            }
+            total += batch.count;
+        }
+        fflush(stdout);
+        fprintf(stderr, "Analyzed %ld positions with %d workers\n", total, started);
+
+        pthread_mutex_lock(&batch.lock);
+        batch.quit = 1;
+        pthread_cond_broadcast(&batch.ready);
+        pthread_mutex_unlock(&batch.lock);
+        for (i=0; i < started; i++) {
+            pthread_join(workers[i].thread, NULL);
+            deleteEngine(workers[i].engine);
+        }
+    }
+    else {
+        printf("Failed to start the analysis workers\n");
+    }
+
+    if (batch.lines != NULL) {
+        for (i=0; i < BATCH_LINES; i++) {
+            free(batch.lines[i]);
+        }
+    }
+    free(batch.lines);
+    free(batch.outputs);
+    free(batch.outputLengths);
+    free(capacities);
+    free(chunk);
+    free(workers);
+    pthread_mutex_destroy(&batch.lock);
+    pthread_cond_destroy(&batch.ready);
+    pthread_cond_destroy(&batch.done);
+    if (input != stdin) {
+        fclose(input);
+    }
+
+    return rc;
+}
+
+/* Default number of random moves at the start of a self-play game */
+#define DEFAULT_OPENING_PLIES  4
+
+/* Error probabilities (alpha and beta) of the SPRT */
+#define SPRT_ALPHA  0.05
+#define SPRT_BETA   0.05
+
+/*
+ * Tournament structure
+ * - Used to share a self-play tournament between the worker threads
+ * - options are the tournament options
+ * - log is the game log the games are appended to (NULL for none)
+ * - next is the index of the next game to play (taken atomically)
+ * - wins, draws and losses are the results of options->players[0]
+ * - stopped is set once the SPRT has reached a decision
+ * - lock protects the results
+ */
+typedef struct Tournament {
+    const Options  *options;
+    GameLog        *log;
+    long            next;
+    long            wins;
+    long            draws;
+    long            losses;
+    int             stopped;
+    double          llr;
+    pthread_mutex_t lock;
+} Tournament;
+
+/*
+ * Tournament worker structure
+ * - Used to hold one self-play worker thread and its two engines
+ */
+typedef struct TournamentWorker {
+    pthread_t   thread;
+    Tournament *tournament;
+    Engine     *engines[2];
+} TournamentWorker;
+
+/*
+ * Play self play game
+ * - Used to play game number index between engines[0] and engines[1]
+ * - Games are played in pairs: both games of a pair start with the same
+ *   random opening (from seed and index / 2), and engines[0] plays 'X' in
+ *   the even game and 'O' in the odd one
+ * - The random opening never plays a winning move
+ * - The engines are seeded from seed and index, so a game doesn't depend on
+ *   the worker playing it
+ * - An engine returning an illegal column loses the game
+ * - The game, opening included, is appended to gameLog (if not NULL) with the
+ *   config of the engine playing 'X'; a game lost by an illegal column is
+ *   logged unfinished
+ * - Returns 1 if engines[0] wins, 0 for a tie and -1 if it loses
+ */
+int playSelfPlayGame(Engine *engines[2], long index, int openingPlies, uint64_t seed, GameLog *gameLog) {
+    Position pos;
+    SearchResult result;
+    char moves[MAX_MOVES];
+    uint64_t state = seed ^ (((uint64_t) (index / 2)) * 0x9E3779B97F4A7C15ULL);
+    uint64_t engineState = seed ^ (((uint64_t) index) * 0xD1B54A32D192ED03ULL);
+    int firstEngine = (int) (index & 1);
+    int outcome = 0;
+    int player, engine, column, ply, tries;
+
+    engines[0]->config.seed = splitMix64(&engineState);
+    engines[1]->config.seed = splitMix64(&engineState);
+    initPosition(&pos, engines[0]->config.width, engines[0]->config.height);
+    for (ply=0; ply < openingPlies; ply++) {
+        player = pos.numFilled & 1;
+        for (tries=0; tries < 64; tries++) {
+            column = (int) (splitMix64(&state) % (uint64_t) pos.width);
+            if (positionCanPlay(&pos, column) && !positionIsWinningMove(&pos, column, player)) {
+                moves[pos.numFilled] = (char) ('A' + column);
+                positionDropDisc(&pos, column, player);
+                break;
+            }
+        }
+    }
+
+    while (outcome == 0 && !positionIsGameOver(&pos)) {
+        player = pos.numFilled & 1;
+        engine = player ^ firstEngine;
+        engineNextMove(engines[engine], &pos, &result);
+        reportSearch(&pos, &result);
+        if (!positionCanPlay(&pos, result.column)) {
+            outcome = (engine == 0) ? -1 : 1;
+            break;
+        }
+        if (positionIsWinningMove(&pos, result.column, player)) {
+            outcome = (engine == 0) ? 1 : -1;
+        }
+        moves[pos.numFilled] = (char) ('A' + result.column);
+        positionDropDisc(&pos, result.column, player);
+    }
+
+    if (gameLog != NULL) {
+        writeGameRecord(gameLog, moves, pos.numFilled, pos.width, pos.height, positionResult(&pos),
+                        PLAYER_AI, &engines[firstEngine]->config);
+    }
+
+    return outcome;
+}
+
+/* Pseudo games added to each of the wins, draws and losses by scoreVariance() */
+#define SCORE_PRIOR_GAMES  0.5
+
+/*
+ * Score variance
+ * - Used to return the variance of the score of one game from the results,
+ *   with the regularized mean score in *mean
+ * - SCORE_PRIOR_GAMES are added to the wins, draws and losses first (as
+ *   fishtest does), so a one-sided match still has a variance above 0
+ */
+double scoreVariance(long wins, long draws, long losses, double *mean) {
+    double w = wins + SCORE_PRIOR_GAMES;
+    double d = draws + SCORE_PRIOR_GAMES;
+    double l = losses + SCORE_PRIOR_GAMES;
+    double n = w + d + l;
+
+    *mean = (w + 0.5 * d) / n;
+    return (w * (1.0 - *mean) * (1.0 - *mean) + d * (0.5 - *mean) * (0.5 - *mean) +
+            l * *mean * *mean) / n;
+}
+
+/*
+ * Sprt llr
+ * - Used to return the log likelihood ratio of the SPRT of elo1 against elo0
+ * - Uses the normal approximation of the results: with N games of mean score
+ *   m and variance v, LLR = N (s1 - s0) (2m - s0 - s1) / (2v), where s0 and
+ *   s1 are the expected scores of elo0 and elo1
+ * - m and v are regularized by scoreVariance(), so lopsided matches stop too
+ */
+double sprtLlr(long wins, long draws, long losses, double elo0, double elo1) {
+    double n = (double) (wins + draws + losses);
+    double mean, variance, s0, s1;
+
+    variance = scoreVariance(wins, draws, losses, &mean);
+    s0 = 1.0 / (1.0 + pow(10.0, -elo0 / 400.0));
+    s1 = 1.0 / (1.0 + pow(10.0, -elo1 / 400.0));
+
+    return n * (s1 - s0) * (2.0 * mean - s0 - s1) / (2.0 * variance);
+}
+
+/*
+ * Tournament worker main
+ * - Entry point of the self-play worker threads
+ * - Plays games until all are played or the SPRT has stopped the tournament
+ */
+void *tournamentWorkerMain(void *arg) {
+    TournamentWorker *worker = (TournamentWorker *) arg;
+    Tournament *tournament = worker->tournament;
+    const Options *options = tournament->options;
+    double lower = log(SPRT_BETA / (1.0 - SPRT_ALPHA));
+    double upper = log((1.0 - SPRT_BETA) / SPRT_ALPHA);
+    long index;
+    int outcome;
+
+    index = __atomic_fetch_add(&tournament->next, 1, __ATOMIC_RELAXED);
+    while (index < options->games && !__atomic_load_n(&tournament->stopped, __ATOMIC_RELAXED)) {
+        outcome = playSelfPlayGame(worker->engines, index, options->openingPlies, options->seed,
+                                   tournament->log);
+
+        pthread_mutex_lock(&tournament->lock);
+        if (outcome > 0) {
+            tournament->wins++;
+        }
+        else if (outcome < 0) {
+            tournament->losses++;
+        }
+        else {
+            tournament->draws++;
+        }
+        if (options->sprt && !tournament->stopped) {
+            tournament->llr = sprtLlr(tournament->wins, tournament->draws, tournament->losses,
+                                      options->sprtElo0, options->sprtElo1);
+            if (tournament->llr <= lower || tournament->llr >= upper) {
+                __atomic_store_n(&tournament->stopped, 1, __ATOMIC_RELAXED);
+            }
+        }
+        pthread_mutex_unlock(&tournament->lock);
+
+        index = __atomic_fetch_add(&tournament->next, 1, __ATOMIC_RELAXED);
+    }
+
+    return NULL;
+}
+
+/*
+ * Elo from score
+ * - Used to return the Elo difference matching an expected score
+ */
+double eloFromScore(double score) {
+    if (score <= 0.0) {
+        return -1000.0;
+    }
+    if (score >= 1.0) {
+        return 1000.0;
+    }
+    return -400.0 * log10(1.0 / score - 1.0);
+}
+
+/*
+ * Run self play
+ * - Used to play options->games games between options->players[0] and
+ *   options->players[1] on options->workers threads
+ * - Each worker has its own pair of engines (searching with a single thread)
+ * - The games are appended to options->gameLog if set
+ * - Reports games per second, the results of players[0] with the 95% error
+ *   of the score and Elo difference, and the SPRT result if requested
+ * - The score and its error are the regularized ones of scoreVariance(), as
+ *   used by the SPRT
+ */
+int runSelfPlay(const Options *options) {
+    Tournament tournament;
+    GameLog gameLog;
+    TournamentWorker *workers = NULL;
+    EngineConfig configs[2];
+    long long start, timeUs;
+    long games;
+    double mean, deviation, error, lower, upper;
+    int numWorkers = options->workers;
+    int started = 0;
+    int i, j;
+
+    if (numWorkers < 1) {
+        numWorkers = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    for (j=0; j < 2; j++) {
+        configs[j] = options->players[j];
+        configs[j].threads = 1;
+    }
+
+    memset(&tournament, 0, sizeof(Tournament));
+    tournament.options = options;
+    if (options->gameLog != NULL) {
+        if (!openGameLog(&gameLog, options->gameLog)) {
+            printf("Failed to open game log %s\n", options->gameLog);
+            return -1;
+        }
+        tournament.log = &gameLog;
+    }
+    pthread_mutex_init(&tournament.lock, NULL);
+    workers = (TournamentWorker *) calloc(numWorkers, sizeof(TournamentWorker));
+
+    start = getTimeUs();
+    if (workers != NULL) {
+        for (started=0; started < numWorkers; started++) {
+            workers[started].tournament = &tournament;
+            workers[started].engines[0] = createEngine(&configs[0]);
+            workers[started].engines[1] = createEngine(&configs[1]);
+            if (workers[started].engines[0] == NULL || workers[started].engines[1] == NULL ||
+                pthread_create(&workers[started].thread, NULL, tournamentWorkerMain, &workers[started]) != 0) {
+                deleteEngine(workers[started].engines[0]);
+                deleteEngine(workers[started].engines[1]);
+                break;
+            }
+        }
+    }
+    for (i=0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+        deleteEngine(workers[i].engines[0]);
+        deleteEngine(workers[i].engines[1]);
+    }
+    timeUs = getTimeUs() - start;
+    free(workers);
+    pthread_mutex_destroy(&tournament.lock);
+    if (tournament.log != NULL) {
+        closeGameLog(tournament.log);
+    }
+
+    if (started == 0) {
+        printf("Failed to start the self-play workers\n");
+        return -1;
+    }
+
+    games = tournament.wins + tournament.draws + tournament.losses;
+    printf("Games: %ld in %.2f s (%.1f games/s) with %d workers\n", games, timeUs / 1000000.0,
+           (timeUs > 0) ? (1000000.0 * games / timeUs) : 0.0, started);
+    if (games > 0) {
+        deviation = sqrt(scoreVariance(tournament.wins, tournament.draws, tournament.losses, &mean));
+        error = 1.96 * deviation / sqrt((double) games);
+        lower = eloFromScore(mean - error);
+        upper = eloFromScore(mean + error);
+        printf("Player 1: %ld wins, %ld draws, %ld losses\n",
+               tournament.wins, tournament.draws, tournament.losses);
+        printf("Score: %.1f%% +/- %.1f%%\n", 100.0 * mean, 100.0 * error);
+        printf("Elo: %.1f (95%% interval %.1f to %.1f)\n", eloFromScore(mean), lower, upper);
+    }
+    if (options->sprt) {
+        printf("SPRT elo0=%.1f elo1=%.1f: LLR %.2f [%.2f, %.2f] %s\n",
+               options->sprtElo0, options->sprtElo1, tournament.llr,
+               log(SPRT_BETA / (1.0 - SPRT_ALPHA)), log((1.0 - SPRT_BETA) / SPRT_ALPHA),
+               (tournament.llr >= log((1.0 - SPRT_BETA) / SPRT_ALPHA)) ? "H1 accepted" :
+               ((tournament.llr <= log(SPRT_BETA / (1.0 - SPRT_ALPHA))) ? "H0 accepted" : "inconclusive"));
+    }
+
+    return 0;
+}
+
+/*
+ * Run replay
+ * - Used to replay every game of the game log options->inputFile on a
+ *   Position and check it
+ * - The records are decoded into one GameRecord and replayed on one Position,
+ *   so nothing is allocated per game
+ * - A game is invalid if it plays an illegal column, goes on after a win or
+ *   doesn't end with its recorded result
+ * - Reports the games, moves and results, and the games replayed per second
+ */
+int runReplay(const Options *options) {
+    GameLogReader reader;
+    GameRecord record;
+    Position pos;
+    long results[RESULT_TIE + 1];
+    long games = 0, moves = 0, invalid = 0;
+    long long start, timeUs;
+    int status, won, i;
+
+    if (!openGameLogReader(&reader, options->inputFile)) {
+        printf("Failed to open game log %s\n", options->inputFile);
+        return -1;
+    }
+    memset(results, 0, sizeof(results));
+
+    start = getTimeUs();
+    while ((status = readGameRecord(&reader, &record)) > 0) {
+        initPosition(&pos, record.width, record.height);
+        won = 0;
+        for (i=0; i < record.numMoves && !won; i++) {
+            if (!positionCanPlay(&pos, record.columns[i])) {
+                break;
+            }
+            positionDropDisc(&pos, record.columns[i], i & 1);
+            won = positionHasFour(&pos, pos.discs[i & 1]);
+        }
+        if (i < record.numMoves || positionResult(&pos) != record.result) {
+            invalid++;
+        }
+        else {
+            results[record.result]++;
+        }
+        games++;
+        moves += record.numMoves;
+    }
+    timeUs = getTimeUs() - start;
+    closeGameLogReader(&reader);
+
+    printf("Games: %ld in %.3f s (%.0f games/s, %.0f moves/s)\n", games, timeUs / 1000000.0,
+           (timeUs > 0) ? (1000000.0 * games / timeUs) : 0.0,
+           (timeUs > 0) ? (1000000.0 * moves / timeUs) : 0.0);
+    printf("Moves: %ld (%.1f per game)\n", moves, (games > 0) ? ((double) moves / games) : 0.0);
+    printf("Results: X %ld, O %ld, tie %ld, unfinished %ld\n", results[RESULT_X_WINS],
+           results[RESULT_O_WINS], results[RESULT_TIE], results[RESULT_NONE]);
+    printf("Invalid: %ld\n", invalid);
+    if (status < 0) {
+        printf("Game log %s is corrupt after %ld games\n", options->inputFile, games);
+        return -1;
+    }
+
+    return (invalid == 0) ? 0 : -1;
+}
+
+/*
+ * Bench type
+ * - Used to identify the micro-benchmarks of MODE_BENCH
+ */
+typedef enum BenchType {
+                         BENCH_CREATE_BOARD,
+                         BENCH_DROP_DISC,
+                         BENCH_GET_SCORE,
+                         BENCH_IS_WIN,
+                         BENCH_IS_WIN_HORIZONTAL,
+                         BENCH_IS_WIN_VERTICAL,
+                         BENCH_IS_WIN_LEFT_DIAGONAL,
+                         BENCH_IS_WIN_RIGHT_DIAGONAL,
+                         BENCH_EVALUATE_POSITION,
+                         BENCH_GET_AI_NEXT_MOVE,
+                         BENCH_MCTS_PLAYOUT,
+                         BENCH_MAX
+} BenchType;
+
+/* Names of the micro-benchmarks, as used in the JSON report */
+const char *benchNames[BENCH_MAX] = {
+    "createBoard/deleteBoard",
+    "dropDisc",
+    "getScore",
+    "isWin",
+    "isWinHorizontal",
+    "isWinVertical",
+    "isWinLeftDiagonal",
+    "isWinRightDiagonal",
+    "evaluatePosition",
+    "getAINextMove",
+    "mctsPlayout"
+};
+
+/* Number of timed samples of each micro-benchmark */
+const int benchSamples[BENCH_MAX] = { 200, 200, 200, 200, 200, 200, 200, 200, 200, 20, 200 };
+
+/* Number of evaluations of each position timed by BENCH_EVALUATE_POSITION */
+#define BENCH_EVALUATE_REPEAT  16
+
+/* Number of playouts from each position timed by BENCH_MCTS_PLAYOUT */
+#define BENCH_PLAYOUT_REPEAT  16
+
+/* A benchmark slower than its baseline by more than this is a regression */
+#define BENCH_REGRESSION_PERCENT  10.0
+
+/*
+ * Bench result structure
+ * - Used to hold the timing of one micro-benchmark
+ * - nsPerOp and opsPerSec are averaged over all the operations
+ * - p50, p90 and p99 are percentiles of the ns/op of the samples
+ * - baseline is the ns/op of the baseline report (0 if there's none)
+ */
+typedef struct BenchResult {
+    double nsPerOp;
+    double opsPerSec;
+    double p50;
+    double p90;
+    double p99;
+    double baseline;
+} BenchResult;
+
+/* Used to keep the compiler from removing the benchmarked calls */
+volatile long benchSink;
+
+/*
+ * Run bench sample
+ * - Used to run one sample of micro-benchmark bench over the corpus games
+ * - Setup (taking games from pool, clearing the table) is done outside the timing
+ * - Returns the time spent in nanoseconds and the number of operations in ops
+ */
+long long runBenchSample(BenchType bench, Game **games, int numGames, Engine *engine,
+                         GamePool *pool, long *ops) {
+    long long elapsed = 0, start;
+    Game *game;
+    Board *board;
+    Position pos;
+    Xoshiro rng;
+    int i, j, x, y, score;
+    char data, row;
+    int won;
+    long sink = 0;
+
+    *ops = 0;
+    for (i=0; i < numGames; i++) {
+        board = games[i]->board;
+        switch (bench) {
+        case BENCH_CREATE_BOARD:
+            start = getTimeNs();
+            for (j=0; j < 100; j++) {
+                board = createBoard(games[i]->board->width, games[i]->board->height);
+                sink += board->width;
+                deleteBoard(board);
+            }
+            elapsed += getTimeNs() - start;
+            *ops += 100;
+            break;
+        case BENCH_DROP_DISC:
+            game = acquireGame(pool, PLAYER_AI, board->width, board->height);
+            start = getTimeNs();
+            for (j=0; benchPositions[i][j] != '\0'; j++) {
+                data = ((j & 1) == 0) ? 'X' : 'O';
+                sink += dropDisc(game, benchPositions[i][j], data, &row, &won, &score);
+            }
+            elapsed += getTimeNs() - start;
+            *ops += j;
+            releaseGame(pool, game);
+            break;
+        case BENCH_GET_SCORE:
+            start = getTimeNs();
+            for (j=0; j < board->width; j++) {
+                getScore(games[i], j, 'X', &score);
+                sink += score;
+                getScore(games[i], j, 'O', &score);
+                sink += score;
+            }
+            elapsed += getTimeNs() - start;
+            *ops += 2 * board->width;
+            break;
+        case BENCH_EVALUATE_POSITION:
+            start = getTimeNs();
+            for (j=0; j < BENCH_EVALUATE_REPEAT; j++) {
+                sink += evaluatePosition(&games[i]->position);
+            }
+            elapsed += getTimeNs() - start;
+            *ops += BENCH_EVALUATE_REPEAT;
+            break;
+        case BENCH_GET_AI_NEXT_MOVE:
+            clearTable(&engine->table);
+            start = getTimeNs();
+            sink += getAINextMove(games[i]);
+            elapsed += getTimeNs() - start;
+            *ops += 1;
+            break;
+        case BENCH_MCTS_PLAYOUT:
+            xoshiroSeed(&rng, (uint64_t) i);
+            start = getTimeNs();
+            for (j=0; j < BENCH_PLAYOUT_REPEAT; j++) {
+                pos = games[i]->position;
+                sink += mctsPlayout(&pos, &rng);
+            }
+            elapsed += getTimeNs() - start;
+            *ops += BENCH_PLAYOUT_REPEAT;
+            break;
+        default:
+            start = getTimeNs();
+            for (x=0; x < board->width; x++) {
+                if (games[i]->position.heights[x] == 0) {
+                    continue;
+                }
+                y = board->height - games[i]->position.heights[x];
+                data = getGrid(board, x, y)->data;
+                if (bench == BENCH_IS_WIN) {
+                    sink += isWin(board, x, y, data, &score);
+                }
+                else if (bench == BENCH_IS_WIN_HORIZONTAL) {
+                    sink += isWinHorizontal(board, x, y, data, &score);
+                }
+                else if (bench == BENCH_IS_WIN_VERTICAL) {
+                    sink += isWinVertical(board, x, y, data, &score);
+                }
+                else if (bench == BENCH_IS_WIN_LEFT_DIAGONAL) {
+                    sink += isWinLeftDiagonal(board, x, y, data, &score);
+                }
+                else {
+                    sink += isWinRightDiagonal(board, x, y, data, &score);
+                }
+                sink += score;
+                *ops += 1;
+            }
+            elapsed += getTimeNs() - start;
+            break;
+        }
+    }
+    benchSink += sink;
+
+    return elapsed;
+}
+
+/*
+ * Compare doubles
+ * - qsort() callback ordering doubles ascending
+ */
+int compareDoubles(const void *a, const void *b) {
+    double valueA = *((const double *) a);
+    double valueB = *((const double *) b);
+
+    return (valueA < valueB) ? -1 : ((valueA > valueB) ? 1 : 0);
+}
+
+/*
+ * Read bench baseline
+ * - Used to read the ns/op of every benchmark from a JSON report written by
+ *   writeBenchJson() into results[].baseline
+ * - Returns 0 if the file can't be read
+ */
+int readBenchBaseline(const char *path, BenchResult *results) {
+    FILE *file = fopen(path, "r");
+    char line[512];
+    char name[128];
+    double nsPerOp;
+    const char *field;
+    int i;
+
+    if (file == NULL) {
+        return 0;
+    }
+    while (fgets(line, sizeof(line), file) != NULL) {
+        field = strstr(line, "\"name\": \"");
+        if (field == NULL || sscanf(field, "\"name\": \"%127[^\"]\"", name) != 1) {
+            continue;
+        }
+        field = strstr(line, "\"ns_per_op\": ");
+        if (field == NULL || sscanf(field, "\"ns_per_op\": %lf", &nsPerOp) != 1) {
+            continue;
+        }
+        for (i=0; i < BENCH_MAX; i++) {
+            if (strcmp(name, benchNames[i]) == 0) {
+                results[i].baseline = nsPerOp;
+            }
+        }
+    }
+    fclose(file);
+
+    return 1;
+}
+
+/*
+ * Write bench json
+ * - Used to write the results as JSON, one benchmark per line
+ * - Returns 0 if the file can't be written
+ */
+int writeBenchJson(const char *path, const BenchResult *results, int width, int height) {
+    FILE *file = fopen(path, "w");
+    int i;
+
+    if (file == NULL) {
+        return 0;
+    }
+    fprintf(file, "{\n  \"board\": \"%dx%d\",\n  \"benchmarks\": [\n", width, height);
+    for (i=0; i < BENCH_MAX; i++) {
+        fprintf(file, "    {\"name\": \"%s\", \"ns_per_op\": %.2f, \"ops_per_sec\": %.0f, "
+                "\"p50\": %.2f, \"p90\": %.2f, \"p99\": %.2f}%s\n",
+                benchNames[i], results[i].nsPerOp, results[i].opsPerSec,
+                results[i].p50, results[i].p90, results[i].p99,
+                (i + 1 < BENCH_MAX) ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+
+    return (fclose(file) == 0);
+}
+
+/*
+ * Run bench
+ * - Used to time the board primitives and getAINextMove() on benchPositions
+ * - Every benchmark runs benchSamples[] samples over the whole corpus and
+ *   reports the mean ns/op, ops/s and the p50/p90/p99 ns/op of the samples
+ * - With options->benchBaseline, every benchmark is compared with the
+ *   baseline and 1 is returned if one is slower by more than
+ *   BENCH_REGRESSION_PERCENT
+ */
+int runBench(const Options *options) {
+    BenchResult results[BENCH_MAX];
+    Game *games[64];
+    GamePool pool;
+    Engine *engine;
+    double samples[256];
+    double delta;
+    long long elapsed, totalNs;
+    long ops, totalOps;
+    int numGames = 0;
+    int bench, i;
+    int rc = 0;
+
+    engine = createEngine(&options->engine);
+    if (engine == NULL) {
+        printf("Failed to create engine\n");
+        return -1;
+    }
+    for (i=0; benchPositions[i] != NULL && numGames < 64; i++) {
+        games[numGames] = createGame(PLAYER_AI, options->engine.width, options->engine.height);
+        if (games[numGames] != NULL) {
+            playMoves(games[numGames], benchPositions[i]);
+            games[numGames]->engine = engine;
+            numGames++;
+        }
+    }
+
+    memset(results, 0, sizeof(results));
+    memset(&pool, 0, sizeof(pool));
+    if (options->benchBaseline != NULL && !readBenchBaseline(options->benchBaseline, results)) {
+        printf("Cannot read baseline %s\n", options->benchBaseline);
+    }
+
+    printf("Position evaluator: %s\n", windowEvaluatorName);
+    printf("%-24s %12s %14s %10s %10s %10s %10s\n", "benchmark", "ns/op", "ops/s",
+           "p50", "p90", "p99", "vs base");
+    for (bench=0; bench < BENCH_MAX; bench++) {
+        totalNs = 0;
+        totalOps = 0;
+        for (i=0; i < benchSamples[bench]; i++) {
+            elapsed = runBenchSample((BenchType) bench, games, numGames, engine, &pool, &ops);
+            samples[i] = (ops > 0) ? ((double) elapsed / ops) : 0.0;
+            totalNs += elapsed;
+            totalOps += ops;
+        }
+        qsort(samples, benchSamples[bench], sizeof(double), compareDoubles);
+        results[bench].nsPerOp = (totalOps > 0) ? ((double) totalNs / totalOps) : 0.0;
+        results[bench].opsPerSec = (totalNs > 0) ? (1e9 * totalOps / totalNs) : 0.0;
+        results[bench].p50 = samples[(benchSamples[bench] * 50) / 100];
+        results[bench].p90 = samples[(benchSamples[bench] * 90) / 100];
+        results[bench].p99 = samples[(benchSamples[bench] * 99) / 100];
+
+        printf("%-24s %12.1f %14.0f %10.1f %10.1f %10.1f", benchNames[bench],
+               results[bench].nsPerOp, results[bench].opsPerSec,
+               results[bench].p50, results[bench].p90, results[bench].p99);
+        if (results[bench].baseline > 0.0) {
+            delta = 100.0 * (results[bench].nsPerOp - results[bench].baseline) / results[bench].baseline;
+            printf(" %+9.1f%%%s", delta, (delta > BENCH_REGRESSION_PERCENT) ? " REGRESSION" : "");
+            if (delta > BENCH_REGRESSION_PERCENT) {
+                rc = 1;
+            }
+        }
+        printf("\n");
+    }
+
+    if (options->benchJson != NULL && !writeBenchJson(options->benchJson, results,
+                                                      options->engine.width, options->engine.height)) {
+        printf("Failed to write %s\n", options->benchJson);
+        rc = -1;
+    }
+
+    for (i=0; i < numGames; i++) {
+        deleteGame(games[i]);
+    }
+    clearGamePool(&pool);
+    deleteEngine(engine);
+
+    return rc;
+}
+
+/* Size of the input and output buffers of a server session */
+#define SESSION_INPUT_SIZE   256
+#define SESSION_OUTPUT_SIZE  4096
+
+/* Room an output buffer must have left to execute one more command */
+#define SERVER_REPLY_SIZE    160
+
+/* Number of events handled per epoll_wait() call */
+#define SERVER_EVENTS        256
+
+/*
+ * Session structure
+ * - Used to hold one client connection of the server and its game
+ * - input holds the bytes read but not executed yet, output the replies not
+ *   written yet (starting at outStart)
+ * - events is the epoll interest set registered for fd
+ * - busy is set while job (a copy of the game position) is queued or searched
+ *   by a worker, which leaves the AI move in result; commands are not
+ *   executed meanwhile, so the replies keep the order of the commands
+ * - eof is set once nothing more is read from the client, dead once the
+ *   session is closed (it's freed at the end of the loop iteration, or once
+ *   its job is done if busy)
+ * - With pondering, the replies to the AI move are searched while the client
+ *   thinks, one at a time in ponderJob (ponderBusy while queued or searched,
+ *   ponderStarted once a worker has taken it, set under the server lock).
+ *   ponderMoves is the number of moves of the game they are the replies of
+ *   (-1 for none), ponderColumns the replies in search order (up to ponderNext
+ *   queued so far), and ponderResults the answers found, valid if pondered has
+ *   the bit of the column. ponderCancel abandons the search of ponderJob.
+ * - awaitPonder is set while an AI command waits for ponderJob, which searches
+ *   the position of the game, since awaitStart
+ * - prev and next link the open sessions, nextJob the job queue, the done
+ *   list or the closed list, nextPonder the ponder queue or the pondered list
+ */
+typedef struct Session {
+    int             fd;
+    Game           *game;
+    unsigned int    events;
+    int             busy;
+    int             eof;
+    int             dead;
+    Position        job;
+    SearchResult    result;
+    Position        ponderJob;
+    SearchResult    ponderResult;
+    int             ponderColumn;
+    int             ponderBusy;
+    int             ponderStarted;
+    int             ponderCancel;
+    int             ponderMoves;
+    int             ponderColumns[MAX_BOARD_WIDTH];
+    int             numPonderColumns;
+    int             ponderNext;
+    unsigned int    pondered;
+    SearchResult    ponderResults[MAX_BOARD_WIDTH];
+    int             awaitPonder;
+    long long       awaitStart;
+    struct Session *prev;
+    struct Session *next;
+    struct Session *nextJob;
+    struct Session *nextPonder;
+    size_t          inLength;
+    size_t          outStart;
+    size_t          outLength;
+    char            input[SESSION_INPUT_SIZE];
+    char            output[SESSION_OUTPUT_SIZE];
+} Session;
+
+/*
+ * Server structure
+ * - Used to share the game server between the event loop and the workers
+ * - listenFd accepts the clients and wakeFd (an eventfd) is written by the
+ *   workers when a job is done; epollFd waits on both and on every session
+ * - sessions lists the open sessions, closed the ones to free, and pool
+ *   recycles their games
+ * - jobs (up to jobsTail) are the AI moves waiting for a worker and done the
+ *   searched ones; ponders (up to pondersTail) and pondered are the same for
+ *   the replies pondered, which the workers only take when there's no AI move
+ *   to search. These lists and quit are protected by lock.
+ * - ponder is 1 if the sessions ponder (--ponder)
+ * - log is the game log the games are appended to when a session starts a
+ *   new game or closes (NULL for none), with the engine config
+ */
+typedef struct Server {
+    int             listenFd;
+    int             wakeFd;
+    int             epollFd;
+    int             width;
+    int             height;
+    Session        *sessions;
+    Session        *closed;
+    GamePool        pool;
+    Session        *jobs;
+    Session        *jobsTail;
+    Session        *done;
+    Session        *ponders;
+    Session        *pondersTail;
+    Session        *pondered;
+    int             quit;
+    int             ponder;
+    GameLog        *log;
+    EngineConfig    config;
+    long            numSessions;
+    long            totalSessions;
+    long            aiMoves;
+    pthread_mutex_t lock;
+    pthread_cond_t  ready;
+} Server;
+
+/*
+ * Server worker structure
+ * - Used to hold one search thread of the server and its private engine
+ */
+typedef struct ServerWorker {
+    pthread_t thread;
+    Server   *server;
+    Engine   *engine;
+} ServerWorker;
+
+/* Set by SIGINT and SIGTERM to stop the server */
+volatile sig_atomic_t serverStopping = 0;
+
+/*
+ * Stop server
+ * - Signal handler of SIGINT and SIGTERM
+ */
+void stopServer(int signalNumber) {
+    (void) signalNumber;
+    serverStopping = 1;
+}
+
+/*
+ * Server worker main
+ * - Entry point of the search threads of the server
+ * - Takes the sessions of the job queue one at a time, searches their position
+ *   and puts them on the done list, waking up the event loop with wakeFd
+ * - The ponder queue is served the same way when the job queue is empty
+ */
+void *serverWorkerMain(void *arg) {
+    ServerWorker *worker = (ServerWorker *) arg;
+    Server *server = worker->server;
+    Session *session;
+    uint64_t one = 1;
+    int ponder;
+
+    pthread_mutex_lock(&server->lock);
+    for (;;) {
+        while (!server->quit && server->jobs == NULL && server->ponders == NULL) {
+            pthread_cond_wait(&server->ready, &server->lock);
+        }
+        if (server->quit) {
+            break;
+        }
+        ponder = (server->jobs == NULL);
+        if (!ponder) {
+            session = server->jobs;
+            server->jobs = session->nextJob;
+            if (server->jobs == NULL) {
+                server->jobsTail = NULL;
+            }
+        }
+        else {
+            session = server->ponders;
+            server->ponders = session->nextPonder;
+            if (server->ponders == NULL) {
+                server->pondersTail = NULL;
+            }
+            session->ponderStarted = 1;
+        }
+        pthread_mutex_unlock(&server->lock);
+
+        if (!ponder) {
+            engineNextMove(worker->engine, &session->job, &session->result);
+        }
+        else {
+            engineSearch(worker->engine, &session->ponderJob, &session->ponderCancel, &session->ponderResult);
+        }
+
+        pthread_mutex_lock(&server->lock);
+        if (!ponder) {
+            session->nextJob = server->done;
+            server->done = session;
+        }
+        else {
+            session->nextPonder = server->pondered;
+            server->pondered = session;
+        }
+        if (write(server->wakeFd, &one, sizeof(one)) != sizeof(one)) {
+            /* The counter can't overflow with one write per job */
+        }
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    return NULL;
+}
+
+/*
+ * Set non blocking
+ * - Used to make the reads and writes of fd return instead of waiting
+ * - Returns 0 on failure
+ */
+int setNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+
+    return (flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0);
+}
+
+/*
+ * Open server socket
+ * - Used to listen on address: "PORT" (on 127.0.0.1) or "HOST:PORT" for TCP,
+ *   anything else is the path of a Unix socket
+ * - A stale Unix socket left by an earlier server is replaced
+ * - Returns the non blocking socket, or -1 with the reason printed
+ */
+int openServerSocket(const char *address, int *isUnix) {
+    struct sockaddr_un unixAddress;
+    struct sockaddr_in inetAddress;
+    struct stat info;
+    const char *colon = strrchr(address, ':');
+    const char *portText = (colon != NULL) ? colon + 1 : address;
+    char host[64] = "127.0.0.1";
+    char *end;
+    long port;
+    int fd = -1;
+    int one = 1;
+
+    port = strtol(portText, &end, 10);
+    *isUnix = (*portText == '\0' || *end != '\0' || strchr(address, '/') != NULL);
+    if (*isUnix) {
+        memset(&unixAddress, 0, sizeof(unixAddress));
+        unixAddress.sun_family = AF_UNIX;
+        if (strlen(address) >= sizeof(unixAddress.sun_path)) {
+            printf("Socket path too long: %s\n", address);
+            return -1;
+        }
+        strcpy(unixAddress.sun_path, address);
+        if (stat(address, &info) == 0 && S_ISSOCK(info.st_mode)) {
+            unlink(address);
+        }
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && bind(fd, (struct sockaddr *) &unixAddress, sizeof(unixAddress)) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    else {
+        memset(&inetAddress, 0, sizeof(inetAddress));
+        inetAddress.sin_family = AF_INET;
+        inetAddress.sin_port = htons((unsigned short) port);
+        if (colon != NULL && colon != address) {
+            snprintf(host, sizeof(host), "%.*s", (int) (colon - address), address);
+        }
+        if (port < 1 || port > 65535 || inet_pton(AF_INET, host, &inetAddress.sin_addr) != 1) {
+            printf("Invalid address: %s\n", address);
+            return -1;
+        }
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd >= 0) {
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            if (bind(fd, (struct sockaddr *) &inetAddress, sizeof(inetAddress)) != 0) {
+                close(fd);
+                fd = -1;
+            }
+        }
+    }
+
+    if (fd >= 0 && (listen(fd, SOMAXCONN) != 0 || !setNonBlocking(fd))) {
+        close(fd);
+        fd = -1;
+    }
+    if (fd < 0) {
+        printf("Cannot listen on %s: %s\n", address, strerror(errno));
+    }
+    return fd;
+}
+
+/*
+ * Session reply
+ * - Used to append the reply text to the output of session
+ * - Commands are only executed with SERVER_REPLY_SIZE bytes left, so a reply
+ *   always fits
+ */
+void sessionReply(Session *session, const char *text) {
+    size_t length = strlen(text);
+
+    if (session->outStart > 0) {
+        memmove(session->output, session->output + session->outStart, session->outLength);
+        session->outStart = 0;
+    }
+    if (session->outLength + length <= SESSION_OUTPUT_SIZE) {
+        memcpy(session->output + session->outLength, text, length);
+        session->outLength += length;
+    }
+}
+
+/*
+ * Session status
+ * - Used to return the status of the game of session: "X" or "O" once won by
+ *   that disc, "tie" once the board is full, "play" otherwise
+ */
+const char *sessionStatus(const Session *session) {
+    const Position *pos = &session->game->position;
+
+    if (positionHasFour(pos, pos->discs[(pos->numFilled & 1) ^ 1])) {
+        return ((pos->numFilled & 1) != 0) ? "X" : "O";
+    }
+    if (positionIsGameOver(pos)) {
+        return "tie";
+    }
+    return "play";
+}
+
+/*
+ * Queue AI move
+ * - Used to hand the position of the game of session to the workers
+ * - The session is busy until finishJobs() gets the move back
+ */
+void queueAIMove(Server *server, Session *session) {
+    session->job = session->game->position;
+    session->busy = 1;
+    session->nextJob = NULL;
+    pthread_mutex_lock(&server->lock);
+    if (server->jobsTail != NULL) {
+        server->jobsTail->nextJob = session;
+    }
+    else {
+        server->jobs = session;
+    }
+    server->jobsTail = session;
+    pthread_cond_signal(&server->ready);
+    pthread_mutex_unlock(&server->lock);
+}
+
+/*
+ * Queue ponder
+ * - Used to hand the next reply of session to ponder to the workers, if
+ *   there's one left and none is pondered yet
+ * - Replies that end the game are skipped
+ */
+void queuePonder(Server *server, Session *session) {
+    Position *pos = &session->game->position;
+    int player = pos->numFilled & 1;
+    int column;
+
+    while (!session->ponderBusy && session->ponderNext < session->numPonderColumns) {
+        column = session->ponderColumns[session->ponderNext++];
+        if (positionIsWinningMove(pos, column, player)) {
+            continue;
         }
-        /* Check downRight */
-        grid = getGrid(board, x, y);
-        while (grid->downRight != NULL && grid->downRight->data == data) {
-            total++;
-            grid = grid->downRight;
+        session->ponderJob = *pos;
+        positionDropDisc(&session->ponderJob, column, player);
+        session->ponderColumn = column;
+        session->ponderCancel = 0;
+        session->ponderBusy = 1;
+        session->ponderStarted = 0;
+        session->nextPonder = NULL;
+        pthread_mutex_lock(&server->lock);
+        if (server->pondersTail != NULL) {
+            server->pondersTail->nextPonder = session;
         }
-
-        if (total >= 4) {
-            winning = 1;
+        else {
+            server->ponders = session;
         }
-        *score = total;
+        server->pondersTail = session;
+        pthread_cond_signal(&server->ready);
+        pthread_mutex_unlock(&server->lock);
     }
-
-    return winning;
 }
 
 /*
- * isWinRightDiagonal
- * - Check if the game is won along the right diagonal direction
- * - board is the game board
- * - (x, y) is the location of the newly added grid
- * - data is either 'X or 'O'
- * - neighbors along upper right and lower left of the current gridof the same type are counted
- * - Total count is returned as score
- * - If total counter is greater than or equal to 4, this is the winner
+ * Unqueue ponder
+ * - Used to take the ponder job of session back from the ponder queue if no
+ *   worker has started it yet, so it doesn't wait behind the other jobs
+ * - Returns 1 if it was taken back (the session no longer ponders), 0 if a
+ *   worker is searching it
  */
-int isWinRightDiagonal(Board *board, int x, int y, char data, int *score) {
-    int winning = 0;
-    Grid *grid = NULL;
-    int total = 1;
+int unqueuePonder(Server *server, Session *session) {
+    Session *prev = NULL;
+    Session *next;
+    int taken = 0;
 
-    if (board) {
-        /* Check upRight */
-        grid = getGrid(board, x, y);
-        while (grid->upRight != NULL && grid->upRight->data == data) {
-            total++;
-            grid = grid->upRight;
+    pthread_mutex_lock(&server->lock);
+    if (!session->ponderStarted) {
+        for (next=server->ponders; next != NULL && next != session; next=next->nextPonder) {
+            prev = next;
         }
-        /* Check downLeft */
-        grid = getGrid(board, x, y);
-        while (grid->downLeft != NULL && grid->downLeft->data == data) {
-            total++;
-            grid = grid->downLeft;
+        if (next == session) {
+            if (prev != NULL) {
+                prev->nextPonder = session->nextPonder;
+            }
+            else {
+                server->ponders = session->nextPonder;
+            }
+            if (server->pondersTail == session) {
+                server->pondersTail = prev;
+            }
+            session->nextPonder = NULL;
+            session->ponderBusy = 0;
+            taken = 1;
         }
+    }
+    pthread_mutex_unlock(&server->lock);
 
-        if (total >= 4) {
-            winning = 1;
-        }
-        *score = total;
-   }
+    return taken;
+}
 
-    return winning;
+/*
+ * Cancel ponder
+ * - Used once the game of session moves on from the position pondered
+ * - No more replies are queued, and the one being searched is cancelled
+ *   unless it's column (the reply played, -1 for none)
+ * - Without a reply played, the replies found so far are dropped too
+ */
+void cancelPonder(Session *session, int column) {
+    session->ponderNext = session->numPonderColumns;
+    if (session->ponderBusy && session->ponderColumn != column) {
+        __atomic_store_n(&session->ponderCancel, 1, __ATOMIC_RELAXED);
+    }
+    if (column < 0) {
+        session->ponderMoves = -1;
+    }
 }
 
 /*
- * isWin
- * - Check if a winner after a new data is added to location (x, y)
- * - 4 paths are checked: horizonal, vertical, left diagonal and right diagonal
- * - data is either 'X' or 'O'
- * - score is highest total count among all 4 paths
+ * Start session ponder
+ * - Used to ponder on the replies to the AI move just played by session, from
+ *   the center out
  */
-int isWin(Board *board, int x, int y, char data, int *score) {
-    int winning = 0;
-    int horizontalScore = 0;
-    int verticalScore = 0;
-    int leftDiagonalScore = 0;
-    int rightDiagonalScore = 0;
-    int highestScore = 0;
+void startSessionPonder(Server *server, Session *session) {
+    Position *pos = &session->game->position;
+    int i, column;
 
-    if (isWinHorizontal(board, x, y, data, &horizontalScore)) {
-        winning = 1;
+    if (!server->ponder || pos->numFilled + 1 >= pos->width * pos->height) {
+        return;
     }
-    else if (isWinVertical(board, x, y, data, &verticalScore)) {
-        winning = 1;
+    cancelPonder(session, -1);
+    session->ponderMoves = session->game->numMoves;
+    session->pondered = 0;
+    session->ponderNext = 0;
+    session->numPonderColumns = 0;
+    for (i=0; i < pos->width; i++) {
+        column = centerColumn(pos->width, i);
+        if (positionCanPlay(pos, column)) {
+            session->ponderColumns[session->numPonderColumns++] = column;
+        }
     }
-    else if (isWinLeftDiagonal(board, x, y, data, &leftDiagonalScore)) {
-        winning = 1;
+    queuePonder(server, session);
+}
+
+/*
+ * Play AI move
+ * - Used to play the AI move of session->result and queue its reply:
+ *   "AI C status score depth nodes time_us source", with the fields of
+ *   analyzeLine() (source can also be ponder)
+ * - The replies of the client are pondered next if the game goes on
+ */
+void playAIMove(Server *server, Session *session) {
+    Game *game = session->game;
+    SearchResult *result = &session->result;
+    char reply[SERVER_REPLY_SIZE];
+    char data = ((game->position.numFilled & 1) == 0) ? 'X' : 'O';
+    char row;
+    int won, score;
+
+    session->ponderMoves = -1;
+    if (result->column < 0 || !positionCanPlay(&game->position, result->column)) {
+        sessionReply(session, "ERR no move\n");
+        return;
     }
-    else if (isWinRightDiagonal(board, x, y, data, &rightDiagonalScore)) {
-        winning = 1;
+    if (game->numMoves == 0) {
+        game->firstPlayer = PLAYER_AI;
     }
+    reportSearch(&game->position, result);
+    dropDisc(game, (char) ('A' + result->column), data, &row, &won, &score);
+    game->numFilled++;
+    game->lastSearch = *result;
+    server->aiMoves++;
+    snprintf(reply, sizeof(reply), "AI %c %s %d %d %ld %lld %s\n",
+             (char) ('A' + result->column), sessionStatus(session),
+             result->score, result->depth, result->nodes, result->timeUs, searchSource(result));
+    sessionReply(session, reply);
+    if (strcmp(sessionStatus(session), "play") == 0) {
+        startSessionPonder(server, session);
+    }
+}
 
-    highestScore = horizontalScore;
-    if (verticalScore > highestScore) {
-        highestScore = verticalScore;
+/*
+ * Execute command
+ * - Used to execute one line of the protocol for session and queue its reply
+ * - NEW starts a new game (logging the current one), MOVE C plays column C
+ *   for the side to move, UNDO
+ *   takes back the last move, STATE describes the game, QUIT closes the
+ *   session; command names are not case sensitive
+ * - AI hands the position to the workers: session becomes busy and the reply
+ *   is queued by playAIMove() once the move is back. If the client played a
+ *   reply pondered already, the answer is played at once; if a worker is
+ *   pondering that reply, its search is waited for, and if it's still queued
+ *   it's taken back and the position is queued as an AI move instead.
+ * - Errors are replied as "ERR reason"
+ */
+void executeCommand(Server *server, Session *session, const char *line) {
+    Game *game = session->game;
+    char command[16];
+    char argument[16];
+    char reply[SERVER_REPLY_SIZE];
+    char moves[MAX_MOVES + 1];
+    char data = ((game->position.numFilled & 1) == 0) ? 'X' : 'O';
+    char row;
+    int won, score;
+    int numArguments;
+    int column;
+    int i;
+
+    numArguments = sscanf(line, "%15s %15s", command, argument);
+    if (numArguments < 1) {
+        return;
     }
-    if (leftDiagonalScore > highestScore) {
-        highestScore = leftDiagonalScore;
+
+    if (strcasecmp(command, "NEW") == 0) {
+        cancelPonder(session, -1);
+        logGame(server->log, game, &server->config);
+        resetGame(game, PLAYER_HUMAN);
+        snprintf(reply, sizeof(reply), "OK %s\n", sessionStatus(session));
     }
-    if (rightDiagonalScore > highestScore) {
-        highestScore = rightDiagonalScore;
+    else if (strcasecmp(command, "MOVE") == 0) {
+        if (strcmp(sessionStatus(session), "play") != 0) {
+            snprintf(reply, sizeof(reply), "ERR game over\n");
+        }
+        else if (numArguments < 2 || argument[1] != '\0' ||
+                 !dropDisc(game, (char) toupper((unsigned char) argument[0]), data, &row, &won, &score)) {
+            snprintf(reply, sizeof(reply), "ERR illegal move\n");
+        }
+        else {
+            game->numFilled++;
+            cancelPonder(session, (game->numMoves == session->ponderMoves + 1) ?
+                                  game->history[game->numMoves - 1].data - 'A' : -1);
+            snprintf(reply, sizeof(reply), "OK %s\n", sessionStatus(session));
+        }
+    }
+    else if (strcasecmp(command, "UNDO") == 0) {
+        if (!unmakeMove(game)) {
+            snprintf(reply, sizeof(reply), "ERR nothing to undo\n");
+        }
+        else {
+            game->numFilled--;
+            cancelPonder(session, -1);
+            snprintf(reply, sizeof(reply), "OK %s\n", sessionStatus(session));
+        }
     }
+    else if (strcasecmp(command, "AI") == 0) {
+        if (strcmp(sessionStatus(session), "play") != 0) {
+            snprintf(reply, sizeof(reply), "ERR game over\n");
+        }
+        else {
+            column = (session->ponderMoves >= 0 && game->numMoves == session->ponderMoves + 1) ?
+                     game->history[game->numMoves - 1].data - 'A' : -1;
+            if (column >= 0 && (session->pondered & (1u << column)) != 0) {
+                session->result = session->ponderResults[column];
+                session->result.timeUs = 0;
+                session->result.ponderHit = 1;
+                playAIMove(server, session);
+            }
+            else if (column >= 0 && session->ponderBusy && session->ponderColumn == column &&
+                     !unqueuePonder(server, session)) {
+                session->busy = 1;
+                session->awaitPonder = 1;
+                session->awaitStart = getTimeUs();
+            }
+            else {
+                queueAIMove(server, session);
+            }
+            return;
+        }
+    }
+    else if (strcasecmp(command, "STATE") == 0) {
+        for (i=0; i < game->numMoves; i++) {
+            moves[i] = game->history[i].data;
+        }
+        if (game->numMoves == 0) {
+            moves[i++] = '-';
+        }
+        moves[i] = '\0';
+        snprintf(reply, sizeof(reply), "STATE %s %c %s\n", moves, data, sessionStatus(session));
+    }
+    else if (strcasecmp(command, "QUIT") == 0) {
+        snprintf(reply, sizeof(reply), "BYE\n");
+        session->eof = 1;
+        session->inLength = 0;
+    }
+    else {
+        snprintf(reply, sizeof(reply), "ERR unknown command\n");
+    }
+    sessionReply(session, reply);
+}
 
-    *score = highestScore;
-    return winning;
+/*
+ * Close session
+ * - Used to remove session from the server and close its connection
+ * - Its game is appended to the game log
+ * - The session is freed by freeClosedSessions() once no event of the
+ *   current loop iteration and no worker refers to it anymore
+ */
+void closeSession(Server *server, Session *session) {
+    if (session->dead) {
+        return;
+    }
+    session->dead = 1;
+    logGame(server->log, session->game, &server->config);
+    epoll_ctl(server->epollFd, EPOLL_CTL_DEL, session->fd, NULL);
+    close(session->fd);
+    if (session->prev != NULL) {
+        session->prev->next = session->next;
+    }
+    else {
+        server->sessions = session->next;
+    }
+    if (session->next != NULL) {
+        session->next->prev = session->prev;
+    }
+    server->numSessions--;
+    if (!session->busy && !session->ponderBusy) {
+        session->nextJob = server->closed;
+        server->closed = session;
+    }
 }
 
 /*
- *isGameOver
- * - Used to return if game is over without a winner (tie game)
- * - Tie game is determined when all grids are filled but no coonect 4.
+ * Free closed sessions
+ * - Used to free the sessions closed during the loop iteration
  */
-int isGameOver(Game *game) {
-    int gameOver = 0;
+void freeClosedSessions(Server *server) {
+    Session *session;
 
-    if (game != NULL) {
-        gameOver = (game->numFilled == MAX_ENTRIES);
+    while (server->closed != NULL) {
+        session = server->closed;
+        server->closed = session->nextJob;
+        releaseGame(&server->pool, session->game);
+        free(session);
     }
-
-    return gameOver;
 }
 
-/* dropDisc */
-int dropDisc(Game *game, char column, char data, char *row, int *won, int *score) {
-    int success = 0;
-    int columnIndex = (int) (column - 'A');
-    Grid *grid = NULL;
-    int i=0;
-    Move *move = NULL, *tmpMove;
-    Board *board = game->board;
+/*
+ * Serve session
+ * - Used to make session progress after any of its events
+ * - Executes the complete lines of the input while the session isn't busy and
+ *   its output has room, writes as much output as the socket takes, then
+ *   closes the session or updates the events it waits for
+ * - A line longer than the input buffer is an error that ends the session
+ */
+void serveSession(Server *server, Session *session) {
+    struct epoll_event event;
+    unsigned int events;
+    char *newline;
+    size_t length;
+    ssize_t written;
+    int progress = 1;
+
+    while (progress && !session->dead) {
+        progress = 0;
+        while (!session->busy && session->outLength + SERVER_REPLY_SIZE <= SESSION_OUTPUT_SIZE &&
+               (newline = (char *) memchr(session->input, '\n', session->inLength)) != NULL) {
+            *newline = '\0';
+            length = (size_t) (newline - session->input) + 1;
+            executeCommand(server, session, session->input);
+            if (session->inLength >= length) {
+                session->inLength -= length;
+                memmove(session->input, session->input + length, session->inLength);
+            }
+        }
+        if (!session->busy && session->inLength == SESSION_INPUT_SIZE &&
+            memchr(session->input, '\n', session->inLength) == NULL) {
+            sessionReply(session, "ERR line too long\n");
+            session->eof = 1;
+            session->inLength = 0;
+        }
 
-    if (board && (columnIndex >= 0 && columnIndex < game->board->width)) {
-        for (i=game->board->height - 1; i >= 0; i--) {
-            grid = getGrid(board, columnIndex, i);
-            if (grid->data != '.') {
+        while (session->outLength > 0) {
+            written = send(session->fd, session->output + session->outStart, session->outLength, MSG_NOSIGNAL);
+            if (written > 0) {
+                session->outStart += (size_t) written;
+                session->outLength -= (size_t) written;
+                progress = 1;
+            }
+            else if (written < 0 && errno == EINTR) {
                 continue;
             }
+            else if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            }
             else {
-                grid->data = data;
-                success = 1;
-                move = (Move *) calloc(1, sizeof(Move));
-                move->data = column;
-                if (game->history == NULL) {
-                    game->history = move;
-                }
-                else {
-                    tmpMove = game->history;
-                    while (tmpMove->next != NULL) {
-                        tmpMove = tmpMove->next;
-                    }
-                    tmpMove->next =  move;
-                }
-                *row = (char) ((int) '0') + (game->board->height - i);
-                *won = isWin(board, columnIndex, i, data, score);
-               break;
+                closeSession(server, session);
+                return;
             }
         }
+        if (session->outLength == 0) {
+            session->outStart = 0;
+        }
     }
 
-    return success;
+    if (session->eof && !session->busy && session->outLength == 0) {
+        closeSession(server, session);
+        return;
+    }
+    events = ((!session->eof && session->inLength < SESSION_INPUT_SIZE) ? EPOLLIN : 0) |
+             ((session->outLength > 0) ? EPOLLOUT : 0);
+    if (events != session->events) {
+        memset(&event, 0, sizeof(event));
+        event.events = events;
+        event.data.ptr = session;
+        epoll_ctl(server->epollFd, EPOLL_CTL_MOD, session->fd, &event);
+        session->events = events;
+    }
 }
 
 /*
- * getScore
- * - Used to return the score of a grid
- * - The grid's column index is represented by columnIndex
- * - The row index is the first '.' from bottom
- * - The score is the highest count of the dame data among all 4 paths
+ * Read session
+ * - Used to read what the client of session sent, up to a full input buffer
+ * - The end of the stream or an error sets session->eof
  */
-int getScore(Game *game, int columnIndex, char data, int *score) {
-    int success = 0;
-    Grid *grid = NULL;
-    int i=0;
-    Move *move = NULL, *tmpMove;
-    Board *board = game->board;
-    int won = 0;
+void readSession(Session *session) {
+    ssize_t count;
 
-    if (board && (columnIndex >= 0 && columnIndex < game->board->width)) {
-        for (i=game->board->height - 1; i >= 0; i--) {
-            grid = getGrid(game->board, columnIndex, i);
-            if (grid->data != '.') {
-                continue;
-            }
-            else {
-                grid->data = data;
-                success = 1;
-                won = isWin(board, columnIndex, i, data, score);
-                /* Reset data */
-                grid->data = '.';
-               break;
+    while (!session->eof && session->inLength < SESSION_INPUT_SIZE) {
+        count = read(session->fd, session->input + session->inLength, SESSION_INPUT_SIZE - session->inLength);
+        if (count > 0) {
+            session->inLength += (size_t) count;
+        }
+        else if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        else {
+            if (count == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                session->eof = 1;
             }
+            break;
         }
     }
+}
 
-    return success;
+/*
+ * Accept sessions
+ * - Used to open a session with a new game for every pending connection
+ */
+void acceptSessions(Server *server) {
+    struct epoll_event event;
+    Session *session;
+    int fd;
+
+    while ((fd = accept(server->listenFd, NULL, NULL)) >= 0) {
+        session = (Session *) calloc(1, sizeof(Session));
+        if (session != NULL) {
+            session->game = acquireGame(&server->pool, PLAYER_HUMAN, server->width, server->height);
+        }
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.ptr = session;
+        if (session == NULL || session->game == NULL || !setNonBlocking(fd) ||
+            epoll_ctl(server->epollFd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            if (session != NULL) {
+                releaseGame(&server->pool, session->game);
+            }
+            free(session);
+            close(fd);
+            continue;
+        }
+        session->fd = fd;
+        session->events = EPOLLIN;
+        session->ponderMoves = -1;
+        session->next = server->sessions;
+        if (server->sessions != NULL) {
+            server->sessions->prev = session;
+        }
+        server->sessions = session;
+        server->numSessions++;
+        server->totalSessions++;
+    }
 }
 
 /*
- * print board
- * - Used to print the game board
+ * Finish jobs
+ * - Used to take back the jobs the workers are done with
+ * - AI moves are played and replied with playAIMove()
+ * - Pondered replies are kept for the AI command to come (or played at once
+ *   if it's waiting), and the next reply is queued if the client hasn't moved
  */
-void printBoard(Board *board) {
-    int i, j;
-    Grid *grid;
-    if (board) {
-        printf("  ");
-        for (i=0; i < board->width; i++) {
-            printf("%c ", *(board->columnHeadings + i));
+void finishJobs(Server *server) {
+    Session *session;
+    Session *done;
+    Session *pondered;
+    uint64_t count;
+    int awaited;
+
+    if (read(server->wakeFd, &count, sizeof(count)) != sizeof(count)) {
+        return;
+    }
+    pthread_mutex_lock(&server->lock);
+    done = server->done;
+    server->done = NULL;
+    pondered = server->pondered;
+    server->pondered = NULL;
+    pthread_mutex_unlock(&server->lock);
+
+    while (done != NULL) {
+        session = done;
+        done = session->nextJob;
+        session->busy = 0;
+        if (session->dead) {
+            if (!session->ponderBusy) {
+                session->nextJob = server->closed;
+                server->closed = session;
+            }
+            continue;
         }
-        printf("\n");
+        playAIMove(server, session);
+        serveSession(server, session);
+    }
 
-        for (i=0; i < board->height; i++) {
-            printf("%c ", *(board->rowHeadings+i));
-            for (j=0; j < board->width; j++) {
-                grid = getGrid(board, j, i);
-                printf("%c ", grid->data);
+    while (pondered != NULL) {
+        session = pondered;
+        pondered = session->nextPonder;
+        session->ponderBusy = 0;
+        awaited = session->awaitPonder;
+        session->awaitPonder = 0;
+        if (awaited) {
+            session->busy = 0;
+        }
+        else if (!session->ponderCancel) {
+            session->ponderResults[session->ponderColumn] = session->ponderResult;
+            session->pondered |= 1u << session->ponderColumn;
+        }
+        if (session->dead) {
+            if (!session->busy) {
+                session->nextJob = server->closed;
+                server->closed = session;
             }
-            printf("\n");
+            continue;
+        }
+        if (awaited && !session->ponderCancel) {
+            session->result = session->ponderResult;
+            session->result.timeUs = getTimeUs() - session->awaitStart;
+            session->result.ponderHit = 1;
+            playAIMove(server, session);
+        }
+        else if (awaited) {
+            queueAIMove(server, session);
         }
+        else if (session->game->numMoves == session->ponderMoves) {
+            queuePonder(server, session);
+        }
+        serveSession(server, session);
     }
 }
 
 /*
- * AI next move
- * - Find the next move (i.e. column) for the computer
- * - The algorithm is:
- *   1. Find the score of the next grid on each column if the human is taken over
- *   2. If the highest score is greater than 2, the computer will use this as next move
- *   3. The idea is to prevent the human from getting a better score in the next move
- *   4. If the human's highest score is less than or equals to 2, the algorithm will
- *      search for the highest score for the computer
- *   5. This is done to improve the winning situation of the computer
- *   6. Finally, a random number generator is used if all fail
+ * Run server
+ * - Used to host any number of games for clients of options->serveAddress
+ * - One thread runs an epoll loop over every connection; the AI moves are
+ *   searched by options->workers threads, each with its own engine, so a
+ *   long search never holds up the other sessions
+ * - Each connection is one session with its own game of the --board size;
+ *   it speaks the line protocol of executeCommand()
+ * - Runs until SIGINT or SIGTERM
  */
-char getAINextMove(Game *game) {
-    char nextMove;
-    int score = 0;
-    int i = 0;
-    int success = 0;
-    int highestScore = 0;
-    int highestColumn = -1;
+int runServer(const Options *options) {
+    EngineConfig config = options->engine;
+    Server server;
+    GameLog gameLog;
+    ServerWorker *workers = NULL;
+    Session *session, *next;
+    struct epoll_event event;
+    struct epoll_event *events = NULL;
+    struct sigaction action;
+    int numWorkers = options->workers;
+    int isUnix = 0;
+    int started = 0;
+    int rc = -1;
+    int count, i;
 
-    for (i=0; i < game->board->width; i++) {
-        success = getScore(game, i, game->humanDisc, &score);
-        if (success) {
-            if (score > highestScore) {
-                highestScore = score;
-                highestColumn = i;
+    if (numWorkers < 1) {
+        numWorkers = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    config.threads = 1;
+
+    memset(&server, 0, sizeof(Server));
+    pthread_mutex_init(&server.lock, NULL);
+    pthread_cond_init(&server.ready, NULL);
+    server.width = config.width;
+    server.height = config.height;
+    server.ponder = config.ponder;
+    config.ponder = 0;
+    server.config = config;
+    if (options->gameLog != NULL) {
+        if (!openGameLog(&gameLog, options->gameLog)) {
+            printf("Failed to open game log %s\n", options->gameLog);
+            return -1;
+        }
+        server.log = &gameLog;
+    }
+    server.wakeFd = eventfd(0, EFD_NONBLOCK);
+    server.epollFd = epoll_create1(0);
+    server.listenFd = openServerSocket(options->serveAddress, &isUnix);
+    events = (struct epoll_event *) calloc(SERVER_EVENTS, sizeof(struct epoll_event));
+    workers = (ServerWorker *) calloc(numWorkers, sizeof(ServerWorker));
+
+    if (server.wakeFd >= 0 && server.epollFd >= 0 && server.listenFd >= 0 &&
+        events != NULL && workers != NULL) {
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.ptr = &server.listenFd;
+        epoll_ctl(server.epollFd, EPOLL_CTL_ADD, server.listenFd, &event);
+        event.data.ptr = &server.wakeFd;
+        epoll_ctl(server.epollFd, EPOLL_CTL_ADD, server.wakeFd, &event);
+        for (started=0; started < numWorkers; started++) {
+            workers[started].server = &server;
+            workers[started].engine = createEngine(&config);
+            if (workers[started].engine == NULL ||
+                pthread_create(&workers[started].thread, NULL, serverWorkerMain, &workers[started]) != 0) {
+                deleteEngine(workers[started].engine);
+                break;
+            }
+        }
+    }
+
+    if (started > 0) {
+        rc = 0;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = stopServer;
+        sigaction(SIGINT, &action, NULL);
+        sigaction(SIGTERM, &action, NULL);
+        fprintf(stderr, "Serving %dx%d games on %s with %d workers\n", server.width, server.height,
+                options->serveAddress, started);
+
+        while (!serverStopping) {
+            count = epoll_wait(server.epollFd, events, SERVER_EVENTS, -1);
+            if (count < 0 && errno != EINTR) {
+                rc = -1;
+                break;
+            }
+            for (i=0; i < count; i++) {
+                if (events[i].data.ptr == &server.listenFd) {
+                    acceptSessions(&server);
+                }
+                else if (events[i].data.ptr == &server.wakeFd) {
+                    finishJobs(&server);
+                }
+                else {
+                    session = (Session *) events[i].data.ptr;
+                    if (session->dead) {
+                        continue;
+                    }
+                    if ((events[i].events & (EPOLLERR | EPOLLHUP)) != 0 &&
+                        (events[i].events & EPOLLIN) == 0) {
+                        closeSession(&server, session);
+                        continue;
+                    }
+                    if ((events[i].events & EPOLLIN) != 0) {
+                        readSession(session);
+                    }
+                    serveSession(&server, session);
+                }
             }
+            freeClosedSessions(&server);
         }
-    }
 
-    if (highestScore > 2) {
-        nextMove = (char) (highestColumn) + 'A';
-    }
-    else {
-        for (i=0; i < game->board->width; i++) {
-            success = getScore(game, i, game->AIDisc, &score);
-            if (success) {
-                if (score > highestScore) {
-                    highestScore = score;
-                    highestColumn = i;
+        pthread_mutex_lock(&server.lock);
+        server.quit = 1;
+        pthread_cond_broadcast(&server.ready);
+        pthread_mutex_unlock(&server.lock);
+        for (i=0; i < started; i++) {
+            pthread_join(workers[i].thread, NULL);
+            deleteEngine(workers[i].engine);
+        }
+        for (i=0; i < 4; i++) {
+            next = (i == 0) ? server.jobs : ((i == 1) ? server.done : ((i == 2) ? server.ponders : server.pondered));
+            while (next != NULL) {
+                session = next;
+                next = (i < 2) ? session->nextJob : session->nextPonder;
+                if (i < 2) {
+                    session->busy = 0;
+                }
+                else {
+                    session->ponderBusy = 0;
+                    session->busy &= !session->awaitPonder;
+                }
+                if (session->dead && !session->busy && !session->ponderBusy) {
+                    session->nextJob = server.closed;
+                    server.closed = session;
                 }
             }
         }
-
-        if (highestColumn != -1) {
-            nextMove = (char) (highestColumn) + 'A';
-        }
-        else {
-            /* Random chosen next move */
-            nextMove = (char) (rand() % 6) + 'A';
+        while (server.sessions != NULL) {
+            closeSession(&server, server.sessions);
         }
+        freeClosedSessions(&server);
+        fprintf(stderr, "Served %ld sessions and %ld AI moves\n", server.totalSessions, server.aiMoves);
+    }
+    else {
+        printf("Failed to start the server\n");
+    }
 
+    clearGamePool(&server.pool);
+    if (server.log != NULL) {
+        closeGameLog(server.log);
+    }
+    if (server.listenFd >= 0) {
+        close(server.listenFd);
+        if (isUnix) {
+            unlink(options->serveAddress);
+        }
     }
+    if (server.epollFd >= 0) {
+        close(server.epollFd);
+    }
+    if (server.wakeFd >= 0) {
+        close(server.wakeFd);
+    }
+    free(events);
+    free(workers);
+    pthread_mutex_destroy(&server.lock);
+    pthread_cond_destroy(&server.ready);
 
-    return nextMove;
+    return rc;
 }
 
 /*
- * Human next move
- * - Prompt the user for the next move ('A' to 'G')
+ * Print usage
+ * - Used to print the command line options
  */
-char getHumanNextMove(Game *game) {
-    char nextMove = 'A';
-    char carriageReturn;
-
-    printf("Enter column ('A' - 'G'): ");
-    scanf("%c", &nextMove);
-    do {
-        scanf("%c", &carriageReturn);
-    } while (carriageReturn != '\n');
-
-    return nextMove;
+void printUsage(const char *program) {
+    printf("Usage: %s [options]\n", program);
+    printf("  --engine fast|search|mcts\n");
+    printf("                         algorithm used by the computer (default search)\n");
+    printf("  --depth N              search depth in plies (default %d, no limit with --movetime)\n",
+           DEFAULT_SEARCH_DEPTH);
+    printf("  --playouts N           playouts per move of mcts (default %d, no limit with --movetime)\n",
+           DEFAULT_MCTS_PLAYOUTS);
+    printf("  --hash MB              transposition table (or mcts tree) size (default %d)\n", DEFAULT_HASH_MB);
+    printf("  --board WxH            board size, up to 9x9 with 64 cells at most (default %dx%d)\n", BOARD_WIDTH, BOARD_HEIGHT);
+    printf("  --movetime T           time budget per move, e.g. 50ms or 2s (default none)\n");
+    printf("  --threads N            number of search threads (default 1)\n");
+    printf("  --stats text|json      write a record of every AI move to stderr (default none)\n");
+    printf("  --ponder               search the replies of the human while it thinks (game and --serve)\n");
+    printf("  --smp-bench            report the search speedup from 1 to N threads\n");
+    printf("  --ordering LIST        move ordering heuristics joined by +, from center, killers,\n");
+    printf("                         history and tt, or all or none (default center+tt)\n");
+    printf("  --order-bench          report the tree size with and without each move ordering\n");
+    printf("  --simd auto|avx2|sse2|scalar\n");
+    printf("                         instruction set of the position evaluator (default auto)\n");
+    printf("  --solve-below N        solve exactly with N empty cells or less (default %d)\n",
+           DEFAULT_SOLVE_BELOW);
+    printf("  --book FILE            opening book looked up before searching\n");
+    printf("  --build-book FILE      build an opening book with the search engine\n");
+    printf("  --book-ply N           plies covered by --build-book (default %d)\n", DEFAULT_BOOK_PLY);
+    printf("  --analyze FILE         analyze one move list per line of FILE (- for stdin)\n");
+    printf("  --workers N            threads of --analyze, --selfplay, --serve and --perft\n");
+    printf("                         (default one per core)\n");
+    printf("  --selfplay N           play N games between --player1 and --player2\n");
+    printf("  --player1 SPEC         engine of player 1, e.g. search,depth=10,movetime=20ms\n");
+    printf("                         (fields: depth, movetime, hash, solve, order, playouts, book;\n");
+    printf("                         default is the engine given by the options above)\n");
+    printf("  --player2 SPEC         engine of player 2, e.g. fast\n");
+    printf("  --opening-plies N      random moves starting each game (default %d)\n",
+           DEFAULT_OPENING_PLIES);
+    printf("  --seed N               seed of the random openings and engines (default 1)\n");
+    printf("  --sprt ELO0,ELO1       stop once the SPRT of player 1 decides between ELO0 and ELO1\n");
+    printf("  --bench                time the board primitives on a fixed set of positions\n");
+    printf("  --bench-json FILE      write the --bench results as JSON\n");
+    printf("  --bench-baseline FILE  compare --bench with a JSON report of an earlier run\n");
+    printf("  --serve ADDR           host games over a socket: PORT or HOST:PORT for TCP, else a\n");
+    printf("                         Unix socket path\n");
+    printf("  --game-log FILE        append the games played (game, --selfplay, --serve) to FILE\n");
+    printf("  --replay FILE          replay and check the games of a game log\n");
+    printf("  --build-index FILE     build a position index of the games of --index-logs\n");
+    printf("  --index-logs LIST      game logs read by --build-index, separated by commas\n");
+    printf("  --query-index FILE     look up the move lists of stdin in a position index\n");
+    printf("  --perft N              count the move sequences of N plies, per first column\n");
+    printf("  --perft-moves LIST     position counted by --perft, as a list of columns (default empty)\n");
+    printf("  --perft-check          cross-check the grid, line count and bitboard win checks\n");
+    printf("  --help                 print this message\n");
 }
 
 /*
- * Process human move
- * - Process the human's next move by
- *   1. Get the next move column
- *   2. Drop the disc to the column
- *   3. Determine if the human is the winner
-*/
-int processHumanMove(Game *game, PlayerType *winner)
-{
-    int success = 0;
-    int retries = 0;
-    char next = ' ';
-    int won = 0;
-    char row;
-    int score = 0;
+ * Parse move time
+ * - Used to parse a time budget such as "50", "50ms" or "2s" into milliseconds
+ * - Returns 0 if text is not a positive time
+ */
+int parseMoveTime(const char *text, int *moveTime) {
+    char *unit;
 
-    while (!success && retries < 5) {
-        next = getHumanNextMove(game);
-        if (next >= 'A' && next <= 'G') {
-            success = dropDisc(game, next, game->humanDisc, &row, &won, &score);
-            if (success) {
-                if (won) {
-                    *winner = PLAYER_HUMAN;
-                }
-                printf("Human adds '%c' to [%c%c]\n", game->humanDisc, next, row);
-            }
-            else {
-                retries++;
-            }
-        }
-        else {
-            retries++;
-        }
+    *moveTime = (int) strtol(text, &unit, 10);
+    if (strcmp(unit, "s") == 0) {
+        *moveTime *= 1000;
+    }
+    else if (*unit != '\0' && strcmp(unit, "ms") != 0) {
+        return 0;
     }
 
-    return success;
+    return (*moveTime >= 1);
 }
 
 /*
- * Process AI move
- * - Process the computer's next move by
- *   1. Get the next move column
- *   2. Drop the disc to the column
- *   3. Determine if the computer is the winner
+ * Parse ordering
+ * - Used to parse a list of move ordering heuristics such as "center+tt",
+ *   "all" or "none" into ORDER_* flags
+ * - Returns 0 on an unknown heuristic
  */
-int processAIMove(Game *game, PlayerType *winner)
-{
-    int success = 0;
-    int retries = 0;
-    char next = ' ';
-    int won = 0;
-    char row;
-    int score = 0;
-    while (!success && retries < 5) {
-        next = getAINextMove(game);
-        success = dropDisc(game, next, game->AIDisc, &row, &won, &score);
-        if (success) {
-            if (won) {
-                *winner = PLAYER_AI;
+int parseOrdering(const char *text, int *ordering) {
+    const char *end;
+    size_t length;
+    int found;
+    int i;
+
+    *ordering = 0;
+    if (strcmp(text, "all") == 0) {
+        *ordering = ORDER_ALL;
+        return 1;
+    }
+    if (strcmp(text, "none") == 0) {
+        return 1;
+    }
+    while (*text != '\0') {
+        end = strchr(text, '+');
+        length = (end != NULL) ? (size_t) (end - text) : strlen(text);
+        found = 0;
+        for (i=0; i < 4; i++) {
+            if (strlen(orderNames[i]) == length && strncmp(text, orderNames[i], length) == 0) {
+                *ordering |= 1 << i;
+                found = 1;
             }
-            printf("Computer adds '%c' to [%c%c]\n", game->AIDisc, next, row);
         }
-        else {
-            retries++;
+        if (!found) {
+            return 0;
+        }
+        text += length;
+        if (*text == '+') {
+            text++;
         }
     }
 
-    return success;
+    return 1;
 }
 
 /*
- * Print game stat
- * - Print the game stat including
- *   1. the board
- *   2. the history list
+ * Parse engine spec
+ * - Used to parse a self-play engine such as "search,depth=10,movetime=20ms"
+ * - The first field is the engine type (fast, search or mcts), followed by
+ *   any of depth, movetime, hash, solve, order, playouts and book, applied
+ *   on top of config
+ * - As with --movetime, a time budget without a depth removes the depth limit
+ *   and a time budget without playouts the playout limit
+ * - Returns 0 on an unknown or malformed field
  */
-void gameStat(Game *game) {
-    Move *move = NULL;
+int parseEngineSpec(const char *spec, EngineConfig *config) {
+    char buffer[256];
+    char *field, *value, *next;
+    int success = 1;
+    int depthSet = 0;
+    int playoutsSet = 0;
 
-    printf("Finally board is\n");
-    printBoard(game->board);
-    printf("\n");
+    if (strlen(spec) >= sizeof(buffer)) {
+        return 0;
+    }
+    strcpy(buffer, spec);
 
-    printf("Moves\n");
-    move = game->history;
-    printf("[");
-    while (move != NULL) {
-        printf("%c", move->data);
-        if (move->next != NULL) {
-            printf(",");
+    for (field=buffer; success && field != NULL; field=next) {
+        next = strchr(field, ',');
+        if (next != NULL) {
+            *next++ = '\0';
+        }
+        value = strchr(field, '=');
+        if (value != NULL) {
+            *value++ = '\0';
+        }
+
+        if (field == buffer && strcmp(field, "fast") == 0) {
+            config->type = ENGINE_FAST;
+        }
+        else if (field == buffer && strcmp(field, "search") == 0) {
+            config->type = ENGINE_SEARCH;
+        }
+        else if (field == buffer && strcmp(field, "mcts") == 0) {
+            config->type = ENGINE_MCTS;
+        }
+        else if (value == NULL || field == buffer) {
+            success = 0;
+        }
+        else if (strcmp(field, "depth") == 0) {
+            config->depth = atoi(value);
+            depthSet = 1;
+            success = (config->depth >= 1);
+        }
+        else if (strcmp(field, "movetime") == 0) {
+            success = parseMoveTime(value, &config->moveTime);
+        }
+        else if (strcmp(field, "hash") == 0) {
+            config->hashMB = atoi(value);
+            success = (config->hashMB >= 1);
+        }
+        else if (strcmp(field, "solve") == 0) {
+            config->solveBelow = atoi(value);
+            success = (config->solveBelow >= 0);
+        }
+        else if (strcmp(field, "order") == 0) {
+            success = parseOrdering(value, &config->ordering);
+        }
+        else if (strcmp(field, "playouts") == 0) {
+            config->playouts = atol(value);
+            playoutsSet = 1;
+            success = (config->playouts >= 1);
+        }
+        else if (strcmp(field, "book") == 0) {
+            config->bookFile = spec + (value - buffer);
+            success = (next == NULL);
         }
         else {
-            printf("]\n");
+            success = 0;
         }
-        move = move->next;
     }
+
+    if (config->moveTime > 0 && !depthSet) {
+        config->depth = MAX_ENTRIES;
+    }
+    if (config->moveTime > 0 && !playoutsSet) {
+        config->playouts = 0;
+    }
+
+    return success;
 }
 
 /*
- * Play game
- * - Play the game
- * - Starts with computer if it supposed to go first
- * - Loop until the same is done (tie or a winner is found)
- * - Human and computer are alternaing to play inside the loop
+ * Parse options
+ * - Used to parse the command line into options
+ * - Returns 0 on an unknown or malformed option
  */
-int playGame(Game *game) {
-    int success = 0;
-    char nextMove = ' ';
-    int done = 0;
-    PlayerType winner = PLAYER_NONE;
-    if (game != NULL) {
-        success = 1;
-        if (game->firstPlayer == PLAYER_AI) {
-            success = processAIMove(game, &winner);
-            if (success && winner == PLAYER_NONE) {
-                game->numFilled++;
-                printBoard(game->board);
+int parseOptions(int argc, char *argv[], Options *options) {
+    const char *playerSpecs[2] = { NULL, NULL };
+    int success = 1;
+    int depthSet = 0;
+    int playoutsSet = 0;
+    int i;
+
+    options->engine.type = ENGINE_SEARCH;
+    options->engine.depth = DEFAULT_SEARCH_DEPTH;
+    options->engine.hashMB = DEFAULT_HASH_MB;
+    options->engine.moveTime = 0;
+    options->engine.threads = 1;
+    options->engine.bookFile = NULL;
+    options->engine.solveBelow = DEFAULT_SOLVE_BELOW;
+    options->engine.width = BOARD_WIDTH;
+    options->engine.height = BOARD_HEIGHT;
+    options->engine.ordering = ORDER_DEFAULT;
+    options->engine.ponder = 0;
+    options->engine.playouts = DEFAULT_MCTS_PLAYOUTS;
+    options->mode = MODE_PLAY;
+    options->outputFile = NULL;
+    options->bookPly = DEFAULT_BOOK_PLY;
+    options->inputFile = NULL;
+    options->workers = 0;
+    options->games = 0;
+    options->openingPlies = DEFAULT_OPENING_PLIES;
+    options->seed = 1;
+    options->sprt = 0;
+    options->sprtElo0 = 0.0;
+    options->sprtElo1 = 0.0;
+    options->benchJson = NULL;
+    options->benchBaseline = NULL;
+    options->serveAddress = NULL;
+    options->gameLog = NULL;
+    options->indexLogs = NULL;
+    options->indexFile = NULL;
+    options->perftDepth = 0;
+    options->perftMoves = "";
+    options->perftCheck = 0;
+    selectWindowEvaluator("auto");
+
+    for (i=1; success && i < argc; i++) {
+        if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "fast") == 0) {
+                options->engine.type = ENGINE_FAST;
+            }
+            else if (strcmp(argv[i], "search") == 0) {
+                options->engine.type = ENGINE_SEARCH;
+            }
+            else if (strcmp(argv[i], "mcts") == 0) {
+                options->engine.type = ENGINE_MCTS;
+            }
+            else {
+                success = 0;
             }
         }
-
-        while (success && !done && winner == PLAYER_NONE) {
-            success = processHumanMove(game, &winner);
-            if (success && winner == PLAYER_NONE) {
-                game->numFilled++;
-                printBoard(game->board);
+        else if (strcmp(argv[i], "--depth") == 0 && i + 1 < argc) {
+            i++;
+            options->engine.depth = atoi(argv[i]);
+            depthSet = 1;
+            if (options->engine.depth < 1) {
+                success = 0;
             }
-            if (isGameOver(game)) {
-                printf("Game over!\n");
-                done = 1;
+        }
+        else if (strcmp(argv[i], "--playouts") == 0 && i + 1 < argc) {
+            i++;
+            options->engine.playouts = atol(argv[i]);
+            playoutsSet = 1;
+            if (options->engine.playouts < 1) {
+                success = 0;
             }
-
-            if (success && !done && winner == PLAYER_NONE) {
-                success = processAIMove(game, &winner);
-                if (success && winner == PLAYER_NONE) {
-                    game->numFilled++;
-                    printBoard(game->board);
-                }
-                if (isGameOver(game)) {
-                    printf("Game over!\n");
-                    done = 1;
-                }
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            i++;
+            options->engine.threads = atoi(argv[i]);
+            if (options->engine.threads < 1 || options->engine.threads > MAX_SEARCH_THREADS) {
+                success = 0;
             }
         }
-
-        if (!success) {
-            printf("Error while playing game\n");
+        else if (strcmp(argv[i], "--smp-bench") == 0) {
+            options->mode = MODE_SMP_BENCH;
         }
-        else {
-            if (winner == PLAYER_AI) {
-                printBoard(game->board);
-                printf("Computer wins!\n");
+        else if (strcmp(argv[i], "--ordering") == 0 && i + 1 < argc) {
+            i++;
+            success = parseOrdering(argv[i], &options->engine.ordering);
+        }
+        else if (strcmp(argv[i], "--order-bench") == 0) {
+            options->mode = MODE_ORDER_BENCH;
+        }
+        else if (strcmp(argv[i], "--solve-below") == 0 && i + 1 < argc) {
+            i++;
+            options->engine.solveBelow = atoi(argv[i]);
+            if (options->engine.solveBelow < 0) {
+                success = 0;
             }
-            else if (winner == PLAYER_HUMAN) {
-                printBoard(game->board);
-                printf("Human wins!\n");
+        }
+        else if (strcmp(argv[i], "--book") == 0 && i + 1 < argc) {
+            i++;
+            options->engine.bookFile = argv[i];
+        }
+        else if (strcmp(argv[i], "--build-book") == 0 && i + 1 < argc) {
+            i++;
+            options->mode = MODE_BUILD_BOOK;
+            options->outputFile = argv[i];
+        }
+        else if (strcmp(argv[i], "--analyze") == 0 && i + 1 < argc) {
+            i++;
+            options->mode = MODE_ANALYZE;
+            options->inputFile = argv[i];
+        }
+        else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            i++;
+            options->workers = atoi(argv[i]);
+            if (options->workers < 1) {
+                success = 0;
+            }
+        }
+        else if (strcmp(argv[i], "--book-ply") == 0 && i + 1 < argc) {
+            i++;
+            options->bookPly = atoi(argv[i]);
+            if (options->bookPly < 1) {
+                success = 0;
             }
-            gameStat(game);
         }
+        else if (strcmp(argv[i], "--movetime") == 0 && i + 1 < argc) {
+            i++;
+            success = parseMoveTime(argv[i], &options->engine.moveTime);
+        }
+        else if (strcmp(argv[i], "--selfplay") == 0 && i + 1 < argc) {
+            i++;
+            options->mode = MODE_SELF_PLAY;
+            options->games = atol(argv[i]);
+            if (options->games < 1) {
+                success = 0;
+            }
+        }
+        else if (strcmp(argv[i], "--bench") == 0) {
+            options->mode = MODE_BENCH;
+        }
+        else if (strcmp(argv[i], "--bench-json") == 0 && i + 1 < argc) {
+            i++;
+            options->benchJson = argv[i];
+        }
+        else if (strcmp(argv[i], "--bench-baseline") == 0 && i + 1 < argc) {
+            i++;
+            options->benchBaseline = argv[i];
+        }
+        else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            i++;
+            options->mode = MODE_SERVE;
+            options->serveAddress = argv[i];
+        }
+        else if (strcmp(argv[i], "--game-log") == 0 && i + 1 < argc) {
+            i++;
+            options->gameLog = argv[i];
+        }
+        else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            i++;
+            options->mode = MODE_REPLAY;
+            options->inputFile = argv[i];
+        }
+        else if (strcmp(argv[i], "--build-index") == 0 && i + 1 < argc) {
+            i++;
+            options->mode = MODE_BUILD_INDEX;
+            options->outputFile = argv[i];
+        }
+        else if (strcmp(argv[i], "--index-logs") == 0 && i + 1 < argc) {
+            i++;
+            options->indexLogs = argv[i];
+        }
+        else if (strcmp(argv[i], "--query-index") == 0 && i + 1 < argc) {
+            i++;
+            options->mode = MODE_QUERY_INDEX;
+            options->indexFile = argv[i];
+        }
+        else if (strcmp(argv[i], "--perft") == 0 && i + 1 < argc) {
+            i++;
+            options->mode = MODE_PERFT;
+            options->perftDepth = atoi(argv[i]);
+            if (options->perftDepth < 1 || options->perftDepth > MAX_MOVES) {
+                success = 0;
+            }
+        }
+        else if (strcmp(argv[i], "--perft-moves") == 0 && i + 1 < argc) {
+            i++;
+            options->perftMoves = argv[i];
+        }
+        else if (strcmp(argv[i], "--perft-check") == 0) {
+            options->perftCheck = 1;
+        }
+        else if (strcmp(argv[i], "--player1") == 0 && i + 1 < argc) {
+            i++;
+            playerSpecs[0] = argv[i];
+        }
+        else if (strcmp(argv[i], "--player2") == 0 && i + 1 < argc) {
+            i++;
+            playerSpecs[1] = argv[i];
+        }
+        else if (strcmp(argv[i], "--opening-plies") == 0 && i + 1 < argc) {
+            i++;
+            options->openingPlies = atoi(argv[i]);
+            if (options->openingPlies < 0) {
+                success = 0;
+            }
+        }
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            i++;
+            options->seed = strtoull(argv[i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--sprt") == 0 && i + 1 < argc) {
+            i++;
+            options->sprt = 1;
+            if (sscanf(argv[i], "%lf,%lf", &options->sprtElo0, &options->sprtElo1) != 2 ||
+                options->sprtElo0 >= options->sprtElo1) {
+                success = 0;
+            }
+        }
+        else if (strcmp(argv[i], "--board") == 0 && i + 1 < argc) {
+            i++;
+            if (sscanf(argv[i], "%dx%d", &options->engine.width, &options->engine.height) != 2 ||
+                !isValidGeometry(options->engine.width, options->engine.height)) {
+                success = 0;
+            }
+        }
+        else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "text") == 0) {
+                statsFormat = STATS_TEXT;
+            }
+            else if (strcmp(argv[i], "json") == 0) {
+                statsFormat = STATS_JSON;
+            }
+            else if (strcmp(argv[i], "none") == 0) {
+                statsFormat = STATS_NONE;
+            }
+            else {
+                success = 0;
+            }
+        }
+        else if (strcmp(argv[i], "--ponder") == 0) {
+            options->engine.ponder = 1;
+        }
+        else if (strcmp(argv[i], "--simd") == 0 && i + 1 < argc) {
+            i++;
+            success = selectWindowEvaluator(argv[i]);
+        }
+        else if (strcmp(argv[i], "--hash") == 0 && i + 1 < argc) {
+            i++;
+            options->engine.hashMB = atoi(argv[i]);
+            if (options->engine.hashMB < 1) {
+                success = 0;
+            }
+        }
+        else {
+            success = 0;
+        }
+    }
+
+    if (options->engine.moveTime > 0 && !depthSet) {
+        options->engine.depth = MAX_ENTRIES;
+    }
+    if (options->engine.moveTime > 0 && !playoutsSet) {
+        options->engine.playouts = 0;
     }
+    options->engine.seed = options->seed;
+    if ((options->mode == MODE_BUILD_INDEX && options->indexLogs == NULL) ||
+        options->bookPly > options->engine.width * options->engine.height ||
+        options->openingPlies >= options->engine.width * options->engine.height) {
+        success = 0;
+    }
+    for (i=0; success && i < 2; i++) {
+        options->players[i] = options->engine;
+        if (playerSpecs[i] != NULL) {
+            success = parseEngineSpec(playerSpecs[i], &options->players[i]);
+        }
+    }
+
     return success;
 }
 
@@ -875,15 +7994,73 @@ int playGame(Game *game) {
  * - Main function to start the connect 4 game
  * - Prompt the human if prefers to go first
  * - Allows repeated game by prompting human the current game is done.
+ * - The AI is configured from the command line (see printUsage())
  */
 int main(int argc, char *argv[]) {
     int rc = -1;
     Game *game = 0;
+    GamePool pool;
+    Engine *engine = NULL;
+    Ponder *ponder = NULL;
+    Options options;
+    GameLog gameLog;
     char yesOrNo = 'n';
     char carriageReturn = '\n';
     PlayerType firstPlayer = PLAYER_AI;
     int done = 0;
 
+    if (!parseOptions(argc, argv, &options)) {
+        printUsage(argv[0]);
+        return rc;
+    }
+    if (options.mode == MODE_SMP_BENCH) {
+        return runSmpBench(&options);
+    }
+    if (options.mode == MODE_ORDER_BENCH) {
+        return runOrderBench(&options);
+    }
+    if (options.mode == MODE_BUILD_BOOK) {
+        return runBuildBook(&options);
+    }
+    if (options.mode == MODE_ANALYZE) {
+        return runAnalyze(&options);
+    }
+    if (options.mode == MODE_SELF_PLAY) {
+        return runSelfPlay(&options);
+    }
+    if (options.mode == MODE_BENCH) {
+        return runBench(&options);
+    }
+    if (options.mode == MODE_SERVE) {
+        return runServer(&options);
+    }
+    if (options.mode == MODE_REPLAY) {
+        return runReplay(&options);
+    }
+    if (options.mode == MODE_BUILD_INDEX) {
+        return runBuildIndex(&options);
+    }
+    if (options.mode == MODE_QUERY_INDEX) {
+        return runQueryIndex(&options);
+    }
+    if (options.mode == MODE_PERFT) {
+        return runPerft(&options);
+    }
+    if (options.gameLog != NULL && !openGameLog(&gameLog, options.gameLog)) {
+        printf("Failed to open game log %s\n", options.gameLog);
+        return rc;
+    }
+    engine = createEngine(&options.engine);
+    if (engine == NULL) {
+        printf("Failed to create engine\n");
+        return rc;
+    }
+
+    if (options.engine.ponder) {
+        ponder = createPonder(engine);
+    }
+
+    memset(&pool, 0, sizeof(pool));
     printf("Welcome to connect 4 game!\n");
     while (!done) {
         firstPlayer = PLAYER_AI;
@@ -904,16 +8081,21 @@ int main(int argc, char *argv[]) {
             printf("Computer plays first using 'X' disc\n");
             printf("Human plays using 'O' disc\n");
         }
-        game = createGame(firstPlayer, BOARD_WIDTH, BOARD_HEIGHT);
+        game = acquireGame(&pool, firstPlayer, options.engine.width, options.engine.height);
         if (game != NULL) {
+            game->engine = engine;
+            game->ponder = ponder;
             if (playGame(game) == 1) {
                 printf("Game completed successfully\n");
             }
             else {
                 printf("Game exits with error\n");
             }
+            if (options.gameLog != NULL) {
+                logGame(&gameLog, game, &options.engine);
+            }
 
-            deleteGame(game);
+            releaseGame(&pool, game);
         }
         else {
             printf("Failed to create game\n");
@@ -927,6 +8109,12 @@ int main(int argc, char *argv[]) {
             scanf("%c", &carriageReturn);
         } while (carriageReturn != '\n');
     }
+    clearGamePool(&pool);
+    deletePonder(ponder);
+    deleteEngine(engine);
+    if (options.gameLog != NULL) {
+        closeGameLog(&gameLog);
+    }
 
     return rc;
 }